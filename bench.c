@@ -0,0 +1,255 @@
+//  Load test for the disco server. Starts a server in this process and
+//  drives it with simulated clients speaking the protocol directly: every
+//  client publishes its keys, then every client fetches VALUES repeatedly.
+//  Each round sends one request per client before collecting the replies,
+//  so the server always sees as many requests in flight as there are clients.
+//
+//  Prints a single JSON object so results can be compared between releases.
+//  RSS and CPU time are for the whole process, clients included.
+//
+//  Usage: bench [-n clients] [-m keys per client] [-r VALUES rounds]
+//               [-e endpoint] [-c]
+//  -c turns on CURVE, with throwaway keys in a temporary directory.
+
+#include "czmq_library.h"
+#include "zsimpledisco.h"
+#include "bench_util.h"
+
+typedef struct {
+    int64_t requests;
+    int64_t *latencies;         //  Round trip of each request, in usecs
+    int64_t usecs;              //  Wall clock time of the whole phase
+    int64_t cpu_usecs;          //  Process CPU time of the whole phase
+} phase_t;
+
+static long
+s_rss_kb (void)
+{
+    long rss = -1;
+    FILE *file = fopen ("/proc/self/status", "r");
+    if (!file)
+        return rss;
+    char line [256];
+    while (fgets (line, sizeof (line), file))
+        if (sscanf (line, "VmRSS: %ld kB", &rss) == 1)
+            break;
+    fclose (file);
+    return rss;
+}
+
+static int
+s_compare_int64 (const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a;
+    int64_t y = *(const int64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static int64_t
+s_percentile (phase_t *phase, int percent)
+{
+    if (!phase->requests)
+        return 0;
+    int64_t index = phase->requests * percent / 100;
+    if (index >= phase->requests)
+        index = phase->requests - 1;
+    return phase->latencies [index];
+}
+
+static void
+s_print_phase (const char *name, phase_t *phase)
+{
+    qsort (phase->latencies, (size_t) phase->requests, sizeof (int64_t), s_compare_int64);
+    printf ("\"%s\":{\"requests\":%" PRId64 ",\"per_sec\":%.1f,"
+        "\"p50_us\":%" PRId64 ",\"p90_us\":%" PRId64 ",\"p99_us\":%" PRId64 ",\"max_us\":%" PRId64 ","
+        "\"cpu_us_per_request\":%.1f}",
+        name, phase->requests,
+        phase->usecs ? phase->requests * 1000000.0 / phase->usecs : 0.0,
+        s_percentile (phase, 50), s_percentile (phase, 90), s_percentile (phase, 99),
+        s_percentile (phase, 100),
+        phase->requests ? (double) phase->cpu_usecs / phase->requests : 0.0);
+}
+
+//  Collect one reply from every client, returns the size of the last frame
+//  of the last reply or -1 if a client timed out
+static int64_t
+s_gather (zsock_t **clients, int nbr_clients, int64_t *sent, phase_t *phase)
+{
+    zpoller_t *poller = zpoller_new (NULL);
+    int client;
+    for (client = 0; client < nbr_clients; client++)
+        zpoller_add (poller, clients [client]);
+
+    int64_t last_size = 0;
+    int waiting = nbr_clients;
+    while (waiting) {
+        zsock_t *which = (zsock_t *) zpoller_wait (poller, 5000);
+        if (!which) {
+            zpoller_destroy (&poller);
+            return -1;
+        }
+        for (client = 0; client < nbr_clients; client++)
+            if (clients [client] == which)
+                break;
+        zmsg_t *reply = zmsg_recv (which);
+        if (phase)
+            phase->latencies [phase->requests++] = zclock_usecs () - sent [client];
+        if (reply && zmsg_last (reply))
+            last_size = (int64_t) zframe_size (zmsg_last (reply));
+        zmsg_destroy (&reply);
+        zpoller_remove (poller, which);
+        waiting--;
+    }
+    zpoller_destroy (&poller);
+    return last_size;
+}
+
+int main (int argn, char *argv [])
+{
+    int nbr_clients = 50;
+    int nbr_keys = 20;
+    int nbr_rounds = 20;
+    bool curve = false;
+    char *endpoint = zsys_sprintf ("ipc:///tmp/bench-disco-%d", getpid ());
+    int arg;
+    for (arg = 1; arg < argn; arg++) {
+        if (streq (argv [arg], "-c"))
+            curve = true;
+        else
+        if (arg + 1 < argn && streq (argv [arg], "-n"))
+            nbr_clients = atoi (argv [++arg]);
+        else
+        if (arg + 1 < argn && streq (argv [arg], "-m"))
+            nbr_keys = atoi (argv [++arg]);
+        else
+        if (arg + 1 < argn && streq (argv [arg], "-r"))
+            nbr_rounds = atoi (argv [++arg]);
+        else
+        if (arg + 1 < argn && streq (argv [arg], "-e")) {
+            zstr_free (&endpoint);
+            endpoint = strdup (argv [++arg]);
+        }
+        else {
+            fprintf (stderr, "Usage: %s [-n clients] [-m keys] [-r rounds] [-e endpoint] [-c]\n", argv [0]);
+            return 1;
+        }
+    }
+    if (nbr_clients < 1 || nbr_keys < 1 || nbr_rounds < 1) {
+        fprintf (stderr, "bench: clients, keys and rounds must be at least 1\n");
+        return 1;
+    }
+
+    //  Throwaway keys: the server's pair, and one client key it allows
+    char keys_dir [] = "/tmp/bench-disco-keys-XXXXXX";
+    char *certstore_path = NULL, *server_path = NULL, *server_secret_path = NULL, *client_path = NULL;
+    zcert_t *server_cert = NULL, *client_cert = NULL;
+    zsimpledisco_t *disco = zsimpledisco_new ();
+    if (curve) {
+        if (!mkdtemp (keys_dir)) {
+            fprintf (stderr, "bench: unable to create %s: %s\n", keys_dir, strerror (errno));
+            return 1;
+        }
+        certstore_path = zsys_sprintf ("%s/public_keys", keys_dir);
+        server_path = zsys_sprintf ("%s/server", keys_dir);
+        server_secret_path = zsys_sprintf ("%s/server_secret", keys_dir);
+        client_path = zsys_sprintf ("%s/client", certstore_path);
+        zsys_dir_create ("%s", certstore_path);
+        server_cert = zcert_new ();
+        client_cert = zcert_new ();
+        zcert_save (server_cert, server_path);
+        zcert_save_public (client_cert, client_path);
+        zsimpledisco_set_certstore_path (disco, certstore_path);
+        zsimpledisco_set_private_key_path (disco, server_secret_path);
+    }
+    zsimpledisco_bind (disco, endpoint);
+
+    zsock_t **clients = (zsock_t **) zmalloc (nbr_clients * sizeof (zsock_t *));
+    int64_t *sent = (int64_t *) zmalloc (nbr_clients * sizeof (int64_t));
+    int client;
+    for (client = 0; client < nbr_clients; client++) {
+        clients [client] = zsock_new (ZMQ_DEALER);
+        if (curve) {
+            zcert_apply (client_cert, clients [client]);
+            zsock_set_curve_serverkey (clients [client], zcert_public_txt (server_cert));
+        }
+        zsock_connect (clients [client], "%s", endpoint);
+    }
+
+    //  Every client completes a handshake before anything is timed
+    for (client = 0; client < nbr_clients; client++)
+        zstr_send (clients [client], "VALUES");
+    if (s_gather (clients, nbr_clients, sent, NULL) < 0) {
+        fprintf (stderr, "bench: server at %s did not answer\n", endpoint);
+        return 1;
+    }
+
+    phase_t publish = { 0, (int64_t *) zmalloc ((size_t) nbr_clients * nbr_keys * sizeof (int64_t)), 0, 0 };
+    int64_t start = zclock_usecs ();
+    int64_t cpu_start = bench_cpu_usecs ();
+    int key;
+    for (key = 0; key < nbr_keys; key++) {
+        for (client = 0; client < nbr_clients; client++) {
+            char *name = zsys_sprintf ("tcp://bench-%d-%d:5670", client, key);
+            char *value = zsys_sprintf ("bench-%d-%d", client, key);
+            sent [client] = zclock_usecs ();
+            zstr_sendx (clients [client], "PUBLISH", name, value, NULL);
+            zstr_free (&name);
+            zstr_free (&value);
+        }
+        if (s_gather (clients, nbr_clients, sent, &publish) < 0) {
+            fprintf (stderr, "bench: PUBLISH timed out\n");
+            return 1;
+        }
+    }
+    publish.usecs = zclock_usecs () - start;
+    publish.cpu_usecs = bench_cpu_usecs () - cpu_start;
+
+    phase_t values = { 0, (int64_t *) zmalloc ((size_t) nbr_clients * nbr_rounds * sizeof (int64_t)), 0, 0 };
+    int64_t snapshot_bytes = 0;
+    start = zclock_usecs ();
+    cpu_start = bench_cpu_usecs ();
+    int round;
+    for (round = 0; round < nbr_rounds; round++) {
+        for (client = 0; client < nbr_clients; client++) {
+            sent [client] = zclock_usecs ();
+            zstr_send (clients [client], "VALUES");
+        }
+        snapshot_bytes = s_gather (clients, nbr_clients, sent, &values);
+        if (snapshot_bytes < 0) {
+            fprintf (stderr, "bench: VALUES timed out\n");
+            return 1;
+        }
+    }
+    values.usecs = zclock_usecs () - start;
+    values.cpu_usecs = bench_cpu_usecs () - cpu_start;
+
+    printf ("{\"endpoint\":\"%s\",\"curve\":%s,\"clients\":%d,\"keys_per_client\":%d,",
+        endpoint, curve ? "true" : "false", nbr_clients, nbr_keys);
+    s_print_phase ("publish", &publish);
+    printf (",");
+    s_print_phase ("values", &values);
+    printf (",\"snapshot_bytes\":%" PRId64 ",\"rss_kb\":%ld}\n", snapshot_bytes, s_rss_kb ());
+
+    for (client = 0; client < nbr_clients; client++)
+        zsock_destroy (&clients [client]);
+    free (clients);
+    free (sent);
+    free (publish.latencies);
+    free (values.latencies);
+    zsimpledisco_destroy (&disco);
+    if (curve) {
+        zsys_file_delete (client_path);
+        zsys_file_delete (server_path);
+        zsys_file_delete (server_secret_path);
+        zsys_dir_delete ("%s", certstore_path);
+        zsys_dir_delete ("%s", keys_dir);
+        zstr_free (&certstore_path);
+        zstr_free (&server_path);
+        zstr_free (&server_secret_path);
+        zstr_free (&client_path);
+        zcert_destroy (&server_cert);
+        zcert_destroy (&client_cert);
+    }
+    zstr_free (&endpoint);
+    return 0;
+}
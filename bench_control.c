@@ -0,0 +1,179 @@
+//  Throughput of publishing through the gateway's control socket, with one
+//  PUB command per message and with PUBN commands carrying a batch each.
+//  A producer DEALER sends into the control ROUTER, which is served the way
+//  gateway_actor serves it: payloads are echoed to a PUB socket and shouted
+//  through a real, started zyre node. Counts the messages that reach a SUB
+//  socket. Runs in rounds of one batch so no socket hits its HWM.
+//
+//  Usage: bench_control [-n messages] [-s payload bytes] [-b batch]
+//                       [-g groups]
+
+#include "zyre.h"
+#include "gateway.h"
+#include "bench_util.h"
+
+//  Serve one control message as gateway_actor does
+static void
+s_serve_control (zsock_t *control, zyre_t *node, gateway_socket_stats_t *zyre_stats,
+                 gateway_pub_t *pub)
+{
+    zmsg_t *msg = zmsg_recv (control);
+    if (!msg)
+        return;
+    zframe_t *routing_id = zmsg_pop (msg);
+    char *command = zmsg_popstr (msg);
+    if (streq (command, "PUB")) {
+        char *group = zmsg_popstr (msg);
+        if (group && zmsg_size (msg)) {
+            gateway_publish_local (pub, group, msg);
+            gateway_shout (node, zyre_stats, group, &msg);
+        }
+        free (group);
+    }
+    else
+    if (streq (command, "PUBN"))
+        gateway_publish_batch (node, zyre_stats, pub, msg);
+    zframe_destroy (&routing_id);
+    zstr_free (&command);
+    zmsg_destroy (&msg);
+}
+
+static int
+s_run (const char *name, bool batched, zyre_t *node, int nbr_messages,
+       size_t payload_size, int batch, int nbr_groups, bench_result_t *result)
+{
+    char *control_endpoint = zsys_sprintf ("inproc://bench-control-%s", name);
+    char *pub_endpoint = zsys_sprintf ("inproc://bench-control-pub-%s", name);
+    zsock_t *producer = zsock_new (ZMQ_DEALER);
+    zsock_t *control = zsock_new (ZMQ_ROUTER);
+    zsock_t *pub = zsock_new (ZMQ_PUB);
+    zsock_t *sub = zsock_new (ZMQ_SUB);
+    zsock_set_sndhwm (producer, batch * 2);
+    zsock_set_rcvhwm (control, batch * 2);
+    zsock_set_sndhwm (pub, batch * 2);
+    zsock_set_rcvhwm (sub, batch * 2);
+    zsock_set_rcvtimeo (sub, 5000);
+    zsock_set_subscribe (sub, "");
+    gateway_pub_t *pub_out = gateway_pub_new (pub, false, NULL);
+    gateway_socket_stats_t zyre_stats = { 0, 0, 0 };
+    zsock_bind (control, "%s", control_endpoint);
+    zsock_connect (producer, "%s", control_endpoint);
+    zsock_bind (pub, "%s", pub_endpoint);
+    zsock_connect (sub, "%s", pub_endpoint);
+    zclock_sleep (100);         //  Let the subscription reach the PUB socket
+
+    char *payload_data = (char *) zmalloc (payload_size);
+    memset (payload_data, 'x', payload_size);
+    zframe_t *payload = zframe_new (payload_data, payload_size);
+    free (payload_data);
+    char **groups = (char **) zmalloc (nbr_groups * sizeof (char *));
+    int group;
+    for (group = 0; group < nbr_groups; group++)
+        groups [group] = zsys_sprintf ("BENCH%d", group);
+
+    int rc = 0;
+    int64_t start = zclock_usecs ();
+    int64_t cpu_start = bench_cpu_usecs ();
+    int sent = 0;
+    while (sent < nbr_messages && rc == 0) {
+        int count = nbr_messages - sent < batch ? nbr_messages - sent : batch;
+        int index;
+        if (batched) {
+            zstr_sendm (producer, "PUBN");
+            for (index = 0; index < count; index++) {
+                zstr_sendm (producer, groups [(sent + index) % nbr_groups]);
+                zframe_send (&payload, producer, ZFRAME_REUSE + (index < count - 1 ? ZFRAME_MORE : 0));
+            }
+            s_serve_control (control, node, &zyre_stats, pub_out);
+        }
+        else {
+            for (index = 0; index < count; index++) {
+                zstr_sendm (producer, "PUB");
+                zstr_sendm (producer, groups [(sent + index) % nbr_groups]);
+                zframe_send (&payload, producer, ZFRAME_REUSE);
+            }
+            for (index = 0; index < count; index++)
+                s_serve_control (control, node, &zyre_stats, pub_out);
+        }
+        for (index = 0; index < count; index++) {
+            zmsg_t *msg = zmsg_recv (sub);
+            if (!msg || zmsg_size (msg) != 3) {
+                zmsg_destroy (&msg);
+                rc = -1;
+                break;
+            }
+            result->bytes += (int64_t) zframe_size (zmsg_last (msg));
+            zmsg_destroy (&msg);
+        }
+        sent += count;
+    }
+    result->messages = sent;
+    result->usecs = zclock_usecs () - start;
+    result->cpu_usecs = bench_cpu_usecs () - cpu_start;
+
+    for (group = 0; group < nbr_groups; group++)
+        zstr_free (&groups [group]);
+    free (groups);
+    zframe_destroy (&payload);
+    gateway_pub_destroy (&pub_out);
+    zsock_destroy (&sub);
+    zsock_destroy (&pub);
+    zsock_destroy (&control);
+    zsock_destroy (&producer);
+    zstr_free (&control_endpoint);
+    zstr_free (&pub_endpoint);
+    return rc;
+}
+
+int main (int argn, char *argv [])
+{
+    int nbr_messages = 200000;
+    int payload_size = 64;
+    int batch = 100;
+    int nbr_groups = 1;
+    int arg;
+    for (arg = 1; arg < argn; arg++) {
+        if (arg + 1 < argn && streq (argv [arg], "-n"))
+            nbr_messages = atoi (argv [++arg]);
+        else
+        if (arg + 1 < argn && streq (argv [arg], "-s"))
+            payload_size = atoi (argv [++arg]);
+        else
+        if (arg + 1 < argn && streq (argv [arg], "-b"))
+            batch = atoi (argv [++arg]);
+        else
+        if (arg + 1 < argn && streq (argv [arg], "-g"))
+            nbr_groups = atoi (argv [++arg]);
+        else {
+            fprintf (stderr, "Usage: %s [-n messages] [-s payload bytes] [-b batch] [-g groups]\n", argv [0]);
+            return 1;
+        }
+    }
+    if (nbr_messages < 1 || payload_size < 1 || batch < 1 || nbr_groups < 1) {
+        fprintf (stderr, "bench_control: messages, payload size, batch and groups must be at least 1\n");
+        return 1;
+    }
+
+    //  A node with no peers: shouts cost what they cost locally
+    zyre_t *node = zyre_new ("bench-control");
+    assert (node);
+    zyre_start (node);
+
+    bench_result_t single = { 0, 0, 0, 0 };
+    bench_result_t batched = { 0, 0, 0, 0 };
+    if (s_run ("pub", false, node, nbr_messages, (size_t) payload_size, batch, nbr_groups, &single)
+    ||  s_run ("pubn", true, node, nbr_messages, (size_t) payload_size, batch, nbr_groups, &batched)) {
+        fprintf (stderr, "bench_control: a message went missing\n");
+        return 1;
+    }
+
+    printf ("{\"payload_bytes\":%d,\"batch\":%d,\"groups\":%d,", payload_size, batch, nbr_groups);
+    bench_print_result ("pub", &single);
+    printf (",");
+    bench_print_result ("pubn", &batched);
+    printf ("}\n");
+
+    zyre_stop (node);
+    zyre_destroy (&node);
+    return 0;
+}
@@ -0,0 +1,107 @@
+//  Compares the server cleanup pause of the old full table scan with the
+//  zexpiry index. Records get timestamps spread over one max_age window, the
+//  way steady heartbeats leave them, then each cleanup tick is timed.
+//
+//  Usage: bench_expire [keys]
+
+#include "czmq_library.h"
+#include "zexpiry.h"
+
+#define MAX_AGE             (60 * 1000)
+#define CLEANUP_INTERVAL    (5 * 1000)
+
+typedef struct {
+    char *key;
+    int64_t ts;
+    size_t expiry_slot;
+} record_t;
+
+static void
+s_record_free (void *item_p)
+{
+    record_t *record = (record_t *) item_p;
+    free (record->key);
+    free (record);
+}
+
+static record_t *
+s_record_new (int n, int keys)
+{
+    record_t *record = (record_t *) zmalloc (sizeof (record_t));
+    record->key = zsys_sprintf ("tcp://10.%d.%d.%d:5670|key", n >> 16 & 0xff, n >> 8 & 0xff, n & 0xff);
+    record->ts = (int64_t) n * MAX_AGE / keys;
+    return record;
+}
+
+//  The cleanup as it was: visit every record, collect and delete the old ones
+static size_t
+s_scan_cleanup (zhash_t *data, int64_t now)
+{
+    zlist_t *keys_to_delete = zlist_new ();
+    record_t *item;
+    for (item = zhash_first (data); item != NULL; item = zhash_next (data))
+        if (item->ts < now - MAX_AGE)
+            zlist_append (keys_to_delete, (void *) zhash_cursor (data));
+    size_t expired = zlist_size (keys_to_delete);
+    const char *del = (const char *) zlist_first (keys_to_delete);
+    while (del) {
+        zhash_delete (data, del);
+        del = (const char *) zlist_next (keys_to_delete);
+    }
+    zlist_destroy (&keys_to_delete);
+    return expired;
+}
+
+static size_t
+s_index_cleanup (zhash_t *data, zexpiry_t *expiry, int64_t now)
+{
+    size_t expired = 0;
+    record_t *item;
+    while ((item = (record_t *) zexpiry_pop_expired (expiry, now))) {
+        zhash_delete (data, item->key);
+        expired++;
+    }
+    return expired;
+}
+
+static void
+s_report (const char *name, const char *phase, int keys, size_t expired, int64_t usecs)
+{
+    printf ("%-6s %-8s keys=%d expired=%zu pause_ms=%.3f\n",
+        name, phase, keys, expired, usecs / 1000.0);
+}
+
+static void
+s_run (const char *name, int keys, bool indexed)
+{
+    zhash_t *data = zhash_new ();
+    zexpiry_t *expiry = zexpiry_new ();
+    for (int n = 0; n < keys; n++) {
+        record_t *record = s_record_new (n, keys);
+        zhash_insert (data, record->key, record);
+        zhash_freefn (data, record->key, s_record_free);
+        if (indexed)
+            zexpiry_set (expiry, record, &record->expiry_slot, record->ts + MAX_AGE);
+    }
+
+    //  Nothing is old enough yet, then one cleanup interval's worth expires
+    int64_t ticks [] = { MAX_AGE, MAX_AGE + CLEANUP_INTERVAL };
+    const char *phases [] = { "idle", "expiring" };
+    for (int tick = 0; tick < 2; tick++) {
+        int64_t start = zclock_usecs ();
+        size_t expired = indexed
+            ? s_index_cleanup (data, expiry, ticks [tick])
+            : s_scan_cleanup (data, ticks [tick]);
+        s_report (name, phases [tick], keys, expired, zclock_usecs () - start);
+    }
+    zexpiry_destroy (&expiry);
+    zhash_destroy (&data);
+}
+
+int main (int argn, char *argv [])
+{
+    int keys = argn > 1 ? atoi (argv [1]) : 1000000;
+    s_run ("scan", keys, false);
+    s_run ("index", keys, true);
+    return 0;
+}
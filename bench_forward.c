@@ -0,0 +1,167 @@
+//  Throughput of the gateway's zyre to PUB forwarding. Messages laid out
+//  like zyre SHOUT events are sent into the gateway end of an inproc pair,
+//  forwarded to a PUB socket and read back from a SUB socket, in batches so
+//  a single thread can drive all three sockets without hitting the HWM.
+//
+//  Two forwarders are timed on the same traffic: "strings" pops every frame
+//  as a string and re-sends them with zstr_sendx, as the gateway used to;
+//  "frames" is gateway_forward_shout, which passes the frames on untouched.
+//
+//  Usage: bench_forward [-n messages] [-s payload bytes] [-b batch]
+
+#include "czmq_library.h"
+#include "gateway.h"
+#include "bench_util.h"
+
+//  The forwarding code the gateway had before it passed frames through
+static int
+s_forward_strings (zmsg_t **msg_p, zsock_t *pub, gateway_pub_t *pub_out)
+{
+    (void) pub_out;
+    zmsg_t *msg = *msg_p;
+    char *event = zmsg_popstr (msg);
+    char *peer = zmsg_popstr (msg);
+    char *name = zmsg_popstr (msg);
+    char *group = zmsg_popstr (msg);
+    char *message = zmsg_popstr (msg);
+    int rc = zstr_sendx (pub, group, name, message, NULL);
+    free (event);
+    free (peer);
+    free (name);
+    free (group);
+    free (message);
+    zmsg_destroy (msg_p);
+    return rc;
+}
+
+static int
+s_forward_frames (zmsg_t **msg_p, zsock_t *pub, gateway_pub_t *pub_out)
+{
+    (void) pub;
+    zframe_t *event = zmsg_pop (*msg_p);
+    zframe_destroy (&event);
+    return gateway_forward_shout (msg_p, pub_out) == 1 ? 0 : -1;
+}
+
+static int
+s_run (const char *name, int (*forward) (zmsg_t **, zsock_t *, gateway_pub_t *),
+       int nbr_messages, size_t payload_size, int batch, bench_result_t *result)
+{
+    char *inbox_endpoint = zsys_sprintf ("inproc://bench-forward-in-%s", name);
+    char *pub_endpoint = zsys_sprintf ("inproc://bench-forward-pub-%s", name);
+    zsock_t *source = zsock_new (ZMQ_PAIR);
+    zsock_t *inbox = zsock_new (ZMQ_PAIR);
+    zsock_t *pub = zsock_new (ZMQ_PUB);
+    zsock_t *sub = zsock_new (ZMQ_SUB);
+    zsock_set_sndhwm (source, batch * 2);
+    zsock_set_rcvhwm (inbox, batch * 2);
+    zsock_set_sndhwm (pub, batch * 2);
+    zsock_set_rcvhwm (sub, batch * 2);
+    zsock_set_subscribe (sub, "");
+    gateway_pub_t *pub_out = gateway_pub_new (pub, false, NULL);
+    zsock_bind (inbox, "%s", inbox_endpoint);
+    zsock_connect (source, "%s", inbox_endpoint);
+    zsock_bind (pub, "%s", pub_endpoint);
+    zsock_connect (sub, "%s", pub_endpoint);
+    zclock_sleep (100);         //  Let the subscription reach the PUB socket
+
+    //  The frames of one SHOUT event, sent over and over without copying
+    char *payload = (char *) zmalloc (payload_size);
+    memset (payload, 'x', payload_size);
+    zframe_t *frames [5] = {
+        zframe_new ("SHOUT", 5),
+        zframe_new ("0123456789ABCDEF0123456789ABCDEF", 32),
+        zframe_new ("bench-peer", 10),
+        zframe_new ("BENCH", 5),
+        zframe_new (payload, payload_size)
+    };
+    free (payload);
+
+    int rc = 0;
+    int64_t start = zclock_usecs ();
+    int64_t cpu_start = bench_cpu_usecs ();
+    int sent = 0;
+    while (sent < nbr_messages && rc == 0) {
+        int count = nbr_messages - sent < batch ? nbr_messages - sent : batch;
+        int index;
+        for (index = 0; index < count; index++) {
+            int frame;
+            for (frame = 0; frame < 5; frame++)
+                zframe_send (&frames [frame], source, ZFRAME_REUSE + (frame < 4 ? ZFRAME_MORE : 0));
+        }
+        for (index = 0; index < count; index++) {
+            zmsg_t *msg = zmsg_recv (inbox);
+            if (!msg || forward (&msg, pub, pub_out)) {
+                rc = -1;
+                break;
+            }
+        }
+        for (index = 0; index < count && rc == 0; index++) {
+            zmsg_t *msg = zmsg_recv (sub);
+            if (!msg || zmsg_size (msg) != 3) {
+                zmsg_destroy (&msg);
+                rc = -1;
+                break;
+            }
+            result->bytes += (int64_t) zframe_size (zmsg_last (msg));
+            zmsg_destroy (&msg);
+        }
+        sent += count;
+    }
+    result->messages = sent;
+    result->usecs = zclock_usecs () - start;
+    result->cpu_usecs = bench_cpu_usecs () - cpu_start;
+
+    int frame;
+    for (frame = 0; frame < 5; frame++)
+        zframe_destroy (&frames [frame]);
+    gateway_pub_destroy (&pub_out);
+    zsock_destroy (&sub);
+    zsock_destroy (&pub);
+    zsock_destroy (&inbox);
+    zsock_destroy (&source);
+    zstr_free (&inbox_endpoint);
+    zstr_free (&pub_endpoint);
+    return rc;
+}
+
+int main (int argn, char *argv [])
+{
+    int nbr_messages = 200000;
+    int payload_size = 1024;
+    int batch = 500;
+    int arg;
+    for (arg = 1; arg < argn; arg++) {
+        if (arg + 1 < argn && streq (argv [arg], "-n"))
+            nbr_messages = atoi (argv [++arg]);
+        else
+        if (arg + 1 < argn && streq (argv [arg], "-s"))
+            payload_size = atoi (argv [++arg]);
+        else
+        if (arg + 1 < argn && streq (argv [arg], "-b"))
+            batch = atoi (argv [++arg]);
+        else {
+            fprintf (stderr, "Usage: %s [-n messages] [-s payload bytes] [-b batch]\n", argv [0]);
+            return 1;
+        }
+    }
+    if (nbr_messages < 1 || payload_size < 1 || batch < 1) {
+        fprintf (stderr, "bench_forward: messages, payload size and batch must be at least 1\n");
+        return 1;
+    }
+
+    bench_result_t strings = { 0, 0, 0, 0 };
+    bench_result_t frames = { 0, 0, 0, 0 };
+    if (s_run ("strings", s_forward_strings, nbr_messages, (size_t) payload_size, batch, &strings)
+    ||  s_run ("frames", s_forward_frames, nbr_messages, (size_t) payload_size, batch, &frames)) {
+        fprintf (stderr, "bench_forward: a message went missing\n");
+        return 1;
+    }
+
+    printf ("{\"payload_bytes\":%d,\"batch\":%d,", payload_size, batch);
+    bench_print_result ("strings", &strings);
+    printf (",");
+    bench_print_result ("frames", &frames);
+    printf ("}\n");
+    return 0;
+}
@@ -0,0 +1,130 @@
+//  Compares zregistry with zhash on the operations the disco server does:
+//  insert, refresh (update an existing key), lookup, iterate and expire
+//  (delete a tenth of the keys), at 10k, 100k and 1M keys.
+//
+//  Usage: bench_registry [keys ...]
+
+#include "czmq_library.h"
+#include "zregistry.h"
+
+typedef struct {
+    const char *name;
+    void *(*new_table) (void);
+    void (*destroy) (void *table);
+    void (*insert) (void *table, const char *key, void *item);
+    void (*update) (void *table, const char *key, void *item);
+    void *(*lookup) (void *table, const char *key);
+    void (*delete) (void *table, const char *key);
+    size_t (*iterate) (void *table);
+} table_ops_t;
+
+static void *s_zhash_new (void) { return zhash_new (); }
+static void s_zhash_destroy (void *table) { zhash_destroy ((zhash_t **) &table); }
+static void s_zhash_insert (void *table, const char *key, void *item) { zhash_insert ((zhash_t *) table, key, item); }
+static void s_zhash_update (void *table, const char *key, void *item) { zhash_update ((zhash_t *) table, key, item); }
+static void *s_zhash_lookup (void *table, const char *key) { return zhash_lookup ((zhash_t *) table, key); }
+static void s_zhash_delete (void *table, const char *key) { zhash_delete ((zhash_t *) table, key); }
+static size_t
+s_zhash_iterate (void *table)
+{
+    size_t count = 0;
+    void *item;
+    for (item = zhash_first ((zhash_t *) table); item != NULL; item = zhash_next ((zhash_t *) table))
+        count += zhash_cursor ((zhash_t *) table) [0] != 0;
+    return count;
+}
+
+static void *s_zregistry_new (void) { return zregistry_new (); }
+static void s_zregistry_destroy (void *table) { zregistry_destroy ((zregistry_t **) &table); }
+static void s_zregistry_insert (void *table, const char *key, void *item) { zregistry_insert ((zregistry_t *) table, key, item); }
+static void s_zregistry_update (void *table, const char *key, void *item) { zregistry_update ((zregistry_t *) table, key, item); }
+static void *s_zregistry_lookup (void *table, const char *key) { return zregistry_lookup ((zregistry_t *) table, key); }
+static void s_zregistry_delete (void *table, const char *key) { zregistry_delete ((zregistry_t *) table, key); }
+static size_t
+s_zregistry_iterate (void *table)
+{
+    size_t count = 0;
+    void *item;
+    for (item = zregistry_first ((zregistry_t *) table); item != NULL; item = zregistry_next ((zregistry_t *) table))
+        count += zregistry_cursor ((zregistry_t *) table) [0] != 0;
+    return count;
+}
+
+static table_ops_t s_tables [] = {
+    { "zhash", s_zhash_new, s_zhash_destroy, s_zhash_insert, s_zhash_update,
+      s_zhash_lookup, s_zhash_delete, s_zhash_iterate },
+    { "zregistry", s_zregistry_new, s_zregistry_destroy, s_zregistry_insert, s_zregistry_update,
+      s_zregistry_lookup, s_zregistry_delete, s_zregistry_iterate },
+};
+
+static void
+s_report (const char *table, const char *op, int keys, int64_t usecs)
+{
+    printf ("%-10s %-8s keys=%-8d total_ms=%-10.3f ns_per_key=%.1f\n",
+        table, op, keys, usecs / 1000.0, usecs * 1000.0 / keys);
+}
+
+static void
+s_run (table_ops_t *ops, char **keys, int nbr_keys)
+{
+    static int item;
+    void *table = ops->new_table ();
+    int n;
+
+    int64_t start = zclock_usecs ();
+    for (n = 0; n < nbr_keys; n++)
+        ops->insert (table, keys [n], &item);
+    s_report (ops->name, "insert", nbr_keys, zclock_usecs () - start);
+
+    start = zclock_usecs ();
+    for (n = 0; n < nbr_keys; n++)
+        ops->update (table, keys [n], &item);
+    s_report (ops->name, "refresh", nbr_keys, zclock_usecs () - start);
+
+    //  Counted so the loop can't be compiled away with NDEBUG
+    int found = 0;
+    start = zclock_usecs ();
+    for (n = 0; n < nbr_keys; n++)
+        found += ops->lookup (table, keys [n]) != NULL;
+    s_report (ops->name, "lookup", nbr_keys, zclock_usecs () - start);
+    if (found != nbr_keys)
+        fprintf (stderr, "bench_registry: %s found %d of %d keys\n", ops->name, found, nbr_keys);
+    assert (found == nbr_keys);
+
+    start = zclock_usecs ();
+    size_t count = ops->iterate (table);
+    s_report (ops->name, "iterate", nbr_keys, zclock_usecs () - start);
+    if (count != (size_t) nbr_keys)
+        fprintf (stderr, "bench_registry: %s iterated %zu of %d keys\n", ops->name, count, nbr_keys);
+    assert (count == (size_t) nbr_keys);
+
+    start = zclock_usecs ();
+    for (n = 0; n < nbr_keys; n += 10)
+        ops->delete (table, keys [n]);
+    s_report (ops->name, "expire", nbr_keys, zclock_usecs () - start);
+
+    ops->destroy (table);
+}
+
+int main (int argn, char *argv [])
+{
+    int default_sizes [] = { 10000, 100000, 1000000 };
+    int nbr_sizes = argn > 1 ? argn - 1 : 3;
+    int size_index;
+    for (size_index = 0; size_index < nbr_sizes; size_index++) {
+        int nbr_keys = argn > 1 ? atoi (argv [size_index + 1]) : default_sizes [size_index];
+        char **keys = (char **) zmalloc (nbr_keys * sizeof (char *));
+        int n;
+        for (n = 0; n < nbr_keys; n++)
+            keys [n] = zsys_sprintf ("tcp://10.%d.%d.%d:5670|rq:rM>}U?@Lns47E1%%kR.o@n%%FcmmsL/@{H8]yf7", n >> 16 & 0xff, n >> 8 & 0xff, n & 0xff);
+
+        size_t table;
+        for (table = 0; table < sizeof (s_tables) / sizeof (s_tables [0]); table++)
+            s_run (&s_tables [table], keys, nbr_keys);
+
+        for (n = 0; n < nbr_keys; n++)
+            zstr_free (&keys [n]);
+        free (keys);
+    }
+    return 0;
+}
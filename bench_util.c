@@ -0,0 +1,24 @@
+#include "czmq_library.h"
+#include <sys/resource.h>
+#include "bench_util.h"
+
+int64_t
+bench_cpu_usecs (void)
+{
+    struct rusage usage;
+    getrusage (RUSAGE_SELF, &usage);
+    return (int64_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000
+         + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+void
+bench_print_result (const char *name, bench_result_t *result)
+{
+    double seconds = result->usecs / 1000000.0;
+    printf ("\"%s\":{\"messages\":%" PRId64 ",\"per_sec\":%.1f,\"mb_per_sec\":%.1f,"
+        "\"cpu_us_per_message\":%.2f}",
+        name, result->messages,
+        seconds > 0 ? result->messages / seconds : 0.0,
+        seconds > 0 ? result->bytes / seconds / (1024 * 1024) : 0.0,
+        result->messages ? (double) result->cpu_usecs / result->messages : 0.0);
+}
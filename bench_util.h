@@ -0,0 +1,20 @@
+#ifndef __BENCH_UTIL_H_INCLUDED__
+#define __BENCH_UTIL_H_INCLUDED__
+
+//  Helpers shared by the benchmarks
+
+//  Messages pushed through one of the forwarding paths
+typedef struct {
+    int64_t messages;
+    int64_t bytes;              //  Payload bytes that reached the subscriber
+    int64_t usecs;
+    int64_t cpu_usecs;
+} bench_result_t;
+
+//  User and system CPU time of the whole process, in usecs
+int64_t bench_cpu_usecs(void);
+
+//  Print result as a "name":{...} JSON member
+void bench_print_result(const char *name, bench_result_t *result);
+
+#endif
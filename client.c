@@ -33,9 +33,11 @@ int main(int argn, char *argv[])
         zsock_t *which = zpoller_wait (poller, 1000);
         if (which == zsimpledisco_socket (disco)) {
             zmsg_t *msg = zmsg_recv (which);
+            char *event = zmsg_popstr (msg);
             char *key = zmsg_popstr (msg);
             char *value = zmsg_popstr (msg);
-            printf("KEY VALUE PAIR: '%s' '%s'\n", key, value);
+            printf("%s KEY VALUE PAIR: '%s' '%s'\n", event, key, value);
+            free (event);
             free (key);
             free (value);
             zmsg_destroy (&msg);
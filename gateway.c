@@ -25,6 +25,9 @@
 
 #include "zyre.h"
 #include "zsimpledisco.h"
+#include "zregistry.h"
+#include "zdirwatch.h"
+#include "gateway.h"
 
 const char *getenv_with_default(const char *key, const char *def)
 {
@@ -32,6 +35,12 @@ const char *getenv_with_default(const char *key, const char *def)
     return val ? val : def;
 }
 
+int getenv_int_with_default(const char *key, int def)
+{
+    const char *val = getenv(key);
+    return val && atoi(val) >= 0 ? atoi(val) : def;
+}
+
 char *
 public_key_from_endpoint(char *endpoint)
 {
@@ -44,74 +53,387 @@ public_key_from_endpoint(char *endpoint)
     return public_key;
 }
 
+//  Public keys that already have a file in the trusted or untrusted
+//  directory, so a rediscovered peer costs a single lookup, and the number
+//  of the next discovered_NNN.key file. The number is recovered from the
+//  files on disk at startup, so it survives restarts.
+typedef struct {
+    zregistry_t *keys;
+    int next_file;
+} known_keys_t;
+
+static void
+s_known_keys_load(known_keys_t *self, zcertstore_t *certstore, const char *path)
+{
+    zlistx_t *certs = zcertstore_certs(certstore);
+    zcert_t *cert = (zcert_t *) zlistx_first(certs);
+    while (cert) {
+        zregistry_update(self->keys, zcert_public_txt(cert), (void *) zcert_public_txt(cert));
+        cert = (zcert_t *) zlistx_next(certs);
+    }
+    zlistx_destroy(&certs);
+
+    zdir_t *dir = zdir_new(path, NULL);
+    if(!dir)
+        return;
+    zlist_t *files = zdir_list(dir);
+    zfile_t *file = (zfile_t *) zlist_first(files);
+    while (file) {
+        int file_num;
+        if(sscanf(zfile_filename(file, path), "discovered_%d.key", &file_num) == 1
+        && file_num >= self->next_file)
+            self->next_file = file_num + 1;
+        file = (zfile_t *) zlist_next(files);
+    }
+    zlist_destroy(&files);
+    zdir_destroy(&dir);
+}
+
+known_keys_t *
+known_keys_new(zcertstore_t *certstore, zcertstore_t *certstore_untrusted,
+    const char *trusted_path, const char *untrusted_path)
+{
+    known_keys_t *self = (known_keys_t *) zmalloc(sizeof (known_keys_t));
+    self->keys = zregistry_new();
+    zregistry_autofree(self->keys);
+    self->next_file = 1;
+    s_known_keys_load(self, certstore, trusted_path);
+    s_known_keys_load(self, certstore_untrusted, untrusted_path);
+    return self;
+}
+
+void
+known_keys_destroy(known_keys_t **self_p)
+{
+    if(*self_p) {
+        known_keys_t *self = *self_p;
+        zregistry_destroy(&self->keys);
+        free(self);
+        *self_p = NULL;
+    }
+}
+
 void
-bootstrap_simpledisco(zsimpledisco_t *disco, zcertstore_t *certstore)
+maybe_create_untrusted_key(known_keys_t *known, const char *untrusted_path, const char *public_key)
 {
+    if(!public_key || zregistry_lookup(known->keys, public_key))
+        return;
+
+    char *untrusted_filename = zsys_sprintf("%s/discovered_%03d.key", untrusted_path, known->next_file++);
+    zsys_debug("gateway: Discovered public_key: %s, adding to %s", public_key, untrusted_filename);
+    zcert_t *cert = zcert_new_from_txt(public_key, "");
+    if(cert) {
+        zcert_save_public(cert, untrusted_filename);
+        zcert_destroy(&cert);
+    }
+    zregistry_update(known->keys, public_key, (void *) public_key);
+    zstr_free(&untrusted_filename);
+}
+
+//  Bring the disco servers we use in line with the simpledisco-endpoint
+//  metadata of the trusted certs: connect to new ones and disconnect from
+//  those whose cert is gone or changed. servers maps each cert's public key
+//  to the endpoint we connected to. Runs at startup and whenever the cert
+//  directory changes.
+void
+bootstrap_simpledisco(zsimpledisco_t *disco, zcertstore_t *certstore,
+    zregistry_t *servers, known_keys_t *known)
+{
+    zregistry_t *wanted = zregistry_new();
+    zregistry_autofree(wanted);
 
     zlistx_t *certs = zcertstore_certs(certstore);
     zcert_t *cert = (zcert_t *) zlistx_first(certs);
     int cert_count = 0;
-    int endpoint_count = 0;
     while (cert) {
         const char *endpoint = zcert_meta (cert, "simpledisco-endpoint");
         const char *public_key = zcert_public_txt(cert);
+        zregistry_update(known->keys, public_key, (void *) public_key);
         if(endpoint) {
             char *real_endpoint = zsys_sprintf("%s|%s", endpoint, public_key);
-            zsys_info("gateway: Connecting to simpledisco server @ %s using %s", endpoint, public_key);
-            zsimpledisco_connect(disco, real_endpoint);
+            zregistry_update(wanted, public_key, real_endpoint);
             zstr_free(&real_endpoint);
-            endpoint_count++;
         }
         cert = (zcert_t *) zlistx_next(certs);
         cert_count++;
     }
+    zlistx_destroy(&certs);
+
+    char *connected;
+    for (connected = zregistry_first(servers); connected != NULL; connected = zregistry_next(servers)) {
+        char *real_endpoint = (char *) zregistry_lookup(wanted, zregistry_cursor(servers));
+        if(!real_endpoint || strneq(real_endpoint, connected)) {
+            zsys_info("gateway: Disconnecting from simpledisco server @ %s", connected);
+            zsimpledisco_disconnect(disco, connected);
+            zregistry_delete(servers, zregistry_cursor(servers));
+        }
+    }
+    char *real_endpoint;
+    for (real_endpoint = zregistry_first(wanted); real_endpoint != NULL; real_endpoint = zregistry_next(wanted)) {
+        const char *public_key = zregistry_cursor(wanted);
+        if(zregistry_lookup(servers, public_key))
+            continue;
+        zsys_info("gateway: Connecting to simpledisco server @ %s", real_endpoint);
+        zsimpledisco_connect(disco, real_endpoint);
+        zregistry_update(servers, public_key, real_endpoint);
+    }
 
     if(cert_count==0)
         zsys_error("gateway: No certs found in certstore");
-    else if(endpoint_count==0)
+    else if(zregistry_size(wanted)==0)
         zsys_error("gateway: No certs found in certstore that contain simpledisco-endpoint metadata");
-    zlistx_destroy(&certs);
+    zregistry_destroy(&wanted);
+}
+
+//  First frame of a shout that carries several payloads for one group,
+//  coalesced from a PUBN control command. The receiving gateway publishes
+//  each frame after it as a message of its own.
+static const char s_batch_marker [] = "\0gateway-batch";
+#define BATCH_MARKER_SIZE (sizeof (s_batch_marker) - 1)
+
+//  The PUB socket and what happened to the messages sent on it. By default
+//  it behaves like any PUB socket: a subscriber without room silently
+//  misses the message, which nobody gets to count. With nodrop the socket
+//  gets ZMQ_XPUB_NODROP and a zero send timeout, so such a send fails for
+//  every subscriber without blocking the gateway, and is counted as
+//  dropped. In a conflated group, which needs nodrop, only the latest
+//  message matters: a message that finds no room waits for it, and is
+//  replaced by the next message of its group meanwhile.
+struct _gateway_pub_t {
+    zsock_t *sock;
+    zregistry_t *conflated;     //  Groups where only the latest message matters
+    zregistry_t *pending;       //  Per conflated group, the message waiting for room
+    gateway_socket_stats_t stats;
+    uint64_t replaced;          //  Conflated messages replaced before they went out
+};
+
+static void
+s_zmsg_free(void *item)
+{
+    zmsg_t *msg = (zmsg_t *) item;
+    zmsg_destroy(&msg);
+}
+
+//  conflate_groups is a space separated list of groups, or NULL
+gateway_pub_t *
+gateway_pub_new(zsock_t *sock, bool nodrop, const char *conflate_groups)
+{
+    gateway_pub_t *self = (gateway_pub_t *) zmalloc(sizeof (gateway_pub_t));
+    self->sock = sock;
+    if(nodrop) {
+        zsock_set_xpub_nodrop(sock, 1);
+        zsock_set_sndtimeo(sock, 0);
+    }
+    self->conflated = zregistry_new();
+    zregistry_autofree(self->conflated);
+    self->pending = zregistry_new();
+    zregistry_set_destructor(self->pending, s_zmsg_free);
+    if(conflate_groups && !nodrop)
+        zsys_warning("gateway: conflated groups need PUB_NODROP, ignoring '%s'", conflate_groups);
+    else
+    if(conflate_groups) {
+        char *groups = strdup(conflate_groups);
+        char *saveptr = NULL;
+        char *group;
+        for (group = strtok_r(groups, " ", &saveptr); group; group = strtok_r(NULL, " ", &saveptr))
+            zregistry_update(self->conflated, group, group);
+        free(groups);
+    }
+    return self;
 }
 
 void
-maybe_create_untrusted_key(
-    zcertstore_t *certstore, zcertstore_t *certstore_untrusted,
-    const char *trusted_path, const char *untrusted_path,
-    const char *public_key)
+gateway_pub_destroy(gateway_pub_t **self_p)
 {
-    zcert_t *cert;
-    cert = zcertstore_lookup(certstore, public_key);
-    if(cert)
-        return;
+    if(*self_p) {
+        gateway_pub_t *self = *self_p;
+        zregistry_destroy(&self->pending);
+        zregistry_destroy(&self->conflated);
+        free(self);
+        *self_p = NULL;
+    }
+}
 
-    cert = zcertstore_lookup(certstore_untrusted, public_key);
-    if(cert)
-        return;
+static int
+s_pub_send_frames(zsock_t *sock, zmsg_t *msg)
+{
+    zframe_t *frame = zmsg_first(msg);
+    while (frame) {
+        zframe_t *next = zmsg_next(msg);
+        if(zframe_send(&frame, sock, ZFRAME_REUSE + (next ? ZFRAME_MORE : 0)) == -1)
+            return -1;
+        frame = next;
+    }
+    return 0;
+}
 
-    int file_num;
-    char *trusted_filename;
-    char *untrusted_filename;
-    for(file_num = 1 ; file_num < 1000 ; file_num++){
-        trusted_filename = zsys_sprintf("%s/discovered_%03d.key", trusted_path, file_num);
-        untrusted_filename = zsys_sprintf("%s/discovered_%03d.key", untrusted_path, file_num);
-        if (!zsys_file_exists(trusted_filename) && !zsys_file_exists(untrusted_filename))
-            break;
-        zstr_free(&trusted_filename);
-        zstr_free(&untrusted_filename);
+//  Send a message whose first frame is the group. The frames are sent
+//  without giving them up. Returns 0 if it went out, -1 if it was dropped
+//  or is waiting for room.
+int
+gateway_pub_send(gateway_pub_t *self, zmsg_t *msg)
+{
+    char *group = NULL;
+    if(zregistry_size(self->conflated)) {
+        group = zframe_strdup(zmsg_first(msg));
+        if(!zregistry_lookup(self->conflated, group))
+            zstr_free(&group);
+    }
+    //  Whatever of the group is still waiting is out of date now
+    if(group && zregistry_lookup(self->pending, group)) {
+        zregistry_delete(self->pending, group);
+        self->replaced++;
     }
-    assert(untrusted_filename);
+    int rc = s_pub_send_frames(self->sock, msg);
+    if(rc == 0)
+        self->stats.out++;
+    else
+    if(group)
+        zregistry_update(self->pending, group, zmsg_dup(msg));
+    else
+        self->stats.dropped++;
+    zstr_free(&group);
+    return rc;
+}
 
-    zsys_debug("gateway: Discovered public_key: %s, adding to %s", public_key, untrusted_filename);
-    cert = zcert_new_from_txt(public_key, "");
-    zcert_save_public(cert, untrusted_filename);
-    zstr_free(&trusted_filename);
-    zstr_free(&untrusted_filename);
+//  Retry the conflated messages waiting for room, returns how many still wait
+size_t
+gateway_pub_flush(gateway_pub_t *self)
+{
+    zmsg_t *msg;
+    for (msg = zregistry_first(self->pending); msg != NULL; msg = zregistry_next(self->pending)) {
+        if(s_pub_send_frames(self->sock, msg) == 0) {
+            self->stats.out++;
+            zregistry_delete(self->pending, zregistry_cursor(self->pending));
+        }
+    }
+    return zregistry_size(self->pending);
+}
+
+//  Forward a zyre SHOUT to the PUB socket as group, name and payload. The
+//  message must still hold the peer, name, group and payload frames that
+//  follow the event; the frames themselves are passed on, so the payload is
+//  never copied and may hold any bytes. A batch is split back into one
+//  message per payload. Destroys the message, returns the number of
+//  messages published or -1.
+int
+gateway_forward_shout(zmsg_t **msg_p, gateway_pub_t *pub)
+{
+    zmsg_t *msg = *msg_p;
+    zframe_t *peer = zmsg_pop(msg);
+    zframe_t *name = zmsg_pop(msg);
+    zframe_t *group = zmsg_pop(msg);
+    zframe_destroy(&peer);
+    if(!group || !zmsg_size(msg)) {
+        zframe_destroy(&name);
+        zframe_destroy(&group);
+        zmsg_destroy(msg_p);
+        return -1;
+    }
+    int count = 0;
+    zframe_t *first = zmsg_first(msg);
+    if(zframe_size(first) == BATCH_MARKER_SIZE
+    && memcmp(zframe_data(first), s_batch_marker, BATCH_MARKER_SIZE) == 0) {
+        zframe_t *marker = zmsg_pop(msg);
+        zframe_destroy(&marker);
+        zframe_t *payload;
+        while ((payload = zmsg_pop(msg))) {
+            zmsg_t *single = zmsg_new();
+            zmsg_append(single, &payload);
+            zmsg_pushmem(single, zframe_data(name), zframe_size(name));
+            zmsg_pushmem(single, zframe_data(group), zframe_size(group));
+            if(gateway_pub_send(pub, single) == 0)
+                count++;
+            zmsg_destroy(&single);
+        }
+        zframe_destroy(&name);
+        zframe_destroy(&group);
+    }
+    else {
+        zmsg_prepend(msg, &name);
+        zmsg_prepend(msg, &group);
+        if(gateway_pub_send(pub, msg) == 0)
+            count++;
+    }
+    zmsg_destroy(msg_p);
+    return count;
+}
+
+//  Publish a payload from the control socket to local subscribers as group,
+//  "local" and the payload frames. The payload is left as it was, so the
+//  same message can be shouted to zyre afterwards.
+void
+gateway_publish_local(gateway_pub_t *pub, const char *group, zmsg_t *payload)
+{
+    zmsg_pushstr(payload, "local");
+    zmsg_pushstr(payload, group);
+    gateway_pub_send(pub, payload);
+    zframe_t *frame = zmsg_pop(payload);
+    zframe_destroy(&frame);
+    frame = zmsg_pop(payload);
+    zframe_destroy(&frame);
+}
+
+//  Shout to zyre, counting what went out and what zyre refused
+int
+gateway_shout(zyre_t *node, gateway_socket_stats_t *stats, const char *group, zmsg_t **msg_p)
+{
+    int rc = zyre_shout(node, group, msg_p);
+    if(rc == 0)
+        stats->out++;
+    else
+        stats->dropped++;
+    zmsg_destroy(msg_p);
+    return rc;
+}
+
+//  Publish the group/payload pairs of a PUBN command. Each payload goes to
+//  local subscribers as a message of its own, and to zyre as one shout per
+//  group; a group with a single payload is shouted as a plain message. The
+//  pairs are taken out of the message. Returns the number of payloads.
+int
+gateway_publish_batch(zyre_t *node, gateway_socket_stats_t *zyre_stats,
+    gateway_pub_t *pub, zmsg_t *pairs)
+{
+    //  Shouts being built, by group
+    zregistry_t *batches = zregistry_new();
+    int count = 0;
+    while (zmsg_size(pairs) >= 2) {
+        char *group = zmsg_popstr(pairs);
+        zmsg_t *single = zmsg_new();
+        zframe_t *payload = zmsg_pop(pairs);
+        zmsg_append(single, &payload);
+        gateway_publish_local(pub, group, single);
+        payload = zmsg_pop(single);
+        zmsg_destroy(&single);
+
+        zmsg_t *batch = (zmsg_t *) zregistry_lookup(batches, group);
+        if(!batch) {
+            batch = zmsg_new();
+            zmsg_addmem(batch, s_batch_marker, BATCH_MARKER_SIZE);
+            zregistry_insert(batches, group, batch);
+        }
+        zmsg_append(batch, &payload);
+        free(group);
+        count++;
+    }
+
+    zmsg_t *batch;
+    for (batch = zregistry_first(batches); batch != NULL; batch = zregistry_next(batches)) {
+        zmsg_t *shout = batch;
+        if(zmsg_size(shout) == 2) {
+            zframe_t *marker = zmsg_pop(shout);
+            zframe_destroy(&marker);
+        }
+        gateway_shout(node, zyre_stats, zregistry_cursor(batches), &shout);
+    }
+    zregistry_destroy(&batches);
+    return count;
 }
 
 static void 
 gateway_actor (zsock_t *pipe, void *args)
 {
-    int64_t last_bootstrap = 0;
     int64_t last_zyre_dump = 0;
 
     const char *endpoint = getenv_with_default(
@@ -121,6 +443,24 @@ gateway_actor (zsock_t *pipe, void *args)
         "PUBSUB_ENDPOINT", "tcp://127.0.0.1:14000");
     const char *control_endpoint = getenv_with_default(
         "CONTROL_ENDPOINT", "tcp://127.0.0.1:14001");
+    const char *metrics_endpoint = getenv("METRICS_ENDPOINT");
+    const char *conflate_groups = getenv("CONFLATE_GROUPS");
+    bool pub_nodrop = getenv_int_with_default("PUB_NODROP", 0) > 0;
+
+    //  Counters for the metrics endpoint
+    uint64_t shouts_forwarded = 0;
+    uint64_t peers_required = 0;
+    gateway_socket_stats_t zyre_stats = { 0, 0, 0 };
+    uint64_t control_messages = 0;
+
+    //  The sockets zyre and the disco client create get the default HWMs,
+    //  including the pipe zyre hands us its events through
+    if (getenv("ZYRE_HWM")) {
+        size_t zyre_hwm = (size_t) getenv_int_with_default("ZYRE_HWM", 1000);
+        zsys_set_sndhwm(zyre_hwm);
+        zsys_set_rcvhwm(zyre_hwm);
+        zsys_set_pipehwm(zyre_hwm);
+    }
 
     const char *private_key_path = getenv_with_default(
         "PRIVATE_KEY_PATH", "client.key_secret");
@@ -139,8 +479,37 @@ gateway_actor (zsock_t *pipe, void *args)
     zcertstore_t *certstore_untrusted = zcertstore_new(untrusted_public_key_dir_path);
     assert(certstore_untrusted);
 
+    known_keys_t *known_keys = known_keys_new(certstore, certstore_untrusted,
+        public_key_dir_path, untrusted_public_key_dir_path);
+
+    //  Endpoint each peer uuid the registry lists was last required at, so
+    //  unchanged registry entries don't go through zyre_require_peer again
+    zregistry_t *required = zregistry_new();
+    zregistry_autofree(required);
+    //  Uuid the registry lists at each endpoint, so the entry of a peer that
+    //  restarted with a new uuid can be dropped from required
+    zregistry_t *required_uuids = zregistry_new();
+    zregistry_autofree(required_uuids);
+    //  Name of each peer zyre is connected to, from ENTER until EXIT
+    zregistry_t *connected = zregistry_new();
+    zregistry_autofree(connected);
+
+    //  Disco servers in use, by the public key of the cert naming them
+    zregistry_t *servers = zregistry_new();
+    zregistry_autofree(servers);
+    zdirwatch_t *certstore_watch = zdirwatch_new(public_key_dir_path);
+    //  Checked once a second, not for every message
+    int64_t certstore_check_at = 0;
+
     zsock_t *pub = zsock_new(ZMQ_PUB);
     zsock_t *control = zsock_new(ZMQ_ROUTER);
+    zsock_set_sndhwm(pub, getenv_int_with_default("PUB_SNDHWM", 1000));
+    zsock_set_rcvhwm(control, getenv_int_with_default("CONTROL_RCVHWM", 1000));
+    if (getenv("PUB_SNDBUF"))
+        zsock_set_sndbuf(pub, getenv_int_with_default("PUB_SNDBUF", 0));
+    if (getenv("CONTROL_RCVBUF"))
+        zsock_set_rcvbuf(control, getenv_int_with_default("CONTROL_RCVBUF", 0));
+    gateway_pub_t *pub_out = gateway_pub_new(pub, pub_nodrop, conflate_groups);
 
     if (-1 == zsock_bind(pub, "%s", pubsub_endpoint)) {
         fprintf(stderr, "Faild to bind to PUBSUB_ENDPOINT %s", pubsub_endpoint);
@@ -153,8 +522,19 @@ gateway_actor (zsock_t *pipe, void *args)
         exit(1);
     }
 
+    zsock_t *metrics = NULL;
+    if (metrics_endpoint) {
+        metrics = zsock_new(ZMQ_STREAM);
+        if (-1 == zsock_bind(metrics, "%s", metrics_endpoint)) {
+            fprintf(stderr, "Faild to bind to METRICS_ENDPOINT %s", metrics_endpoint);
+            perror(" ");
+            exit(1);
+        }
+    }
+
     zsimpledisco_t *disco = zsimpledisco_new();
     zsimpledisco_verbose(disco);
+    zsimpledisco_watch(disco, NULL);
 
     zcert_t *cert = NULL;
     if(private_key_path) {
@@ -168,6 +548,9 @@ gateway_actor (zsock_t *pipe, void *args)
         zsock_wait(auth);
     }
 
+    //  Only now, so the server sockets get our private key for CURVE
+    bootstrap_simpledisco(disco, certstore, servers, known_keys);
+
     zyre_t *node = zyre_new ((char *) args);
     if (!node)
         return;                 //  Could not create new node
@@ -198,8 +581,13 @@ gateway_actor (zsock_t *pipe, void *args)
     bool terminated = false;
 
     zpoller_t *poller = zpoller_new (pipe, zyre_socket (node), zsimpledisco_socket(disco), control, NULL);
+    if (metrics)
+        zpoller_add (poller, metrics);
+    size_t pending = 0;
     while (!terminated) {
-        void *which = zpoller_wait (poller, 5000);
+        //  Conflated messages waiting for room are retried often, and an
+        //  idle gateway still checks the cert directory every second
+        void *which = zpoller_wait (poller, pending ? 10 : 1000);
         if (which == pipe) {
             zmsg_t *msg = zmsg_recv (which);
             if (!msg)
@@ -218,41 +606,81 @@ gateway_actor (zsock_t *pipe, void *args)
         else
         if (which == zyre_socket (node)) {
             zmsg_t *msg = zmsg_recv (which);
-            char *event = zmsg_popstr (msg);
-            char *peer = zmsg_popstr (msg);
-            char *name = zmsg_popstr (msg);
-            char *group = zmsg_popstr (msg);
-            char *message = zmsg_popstr (msg);
-
-            if (streq (event, "SHOUT")) {
-                //zsys_debug("zyre->pub %s: %s: %s", group, name, message);
-                zstr_sendx (pub, group, name, message, NULL);
+            if (!msg)
+                break;              //  Interrupted
+
+            zframe_t *event = zmsg_pop (msg);
+            if (zframe_streq (event, "SHOUT")) {
+                zyre_stats.in++;
+                int forwarded = gateway_forward_shout (&msg, pub_out);
+                if (forwarded > 0)
+                    shouts_forwarded += forwarded;
             }
             else
-            if (streq (event, "ENTER"))
+            if (zframe_streq (event, "ENTER")) {
+                char *peer = zmsg_popstr (msg);
+                char *name = zmsg_popstr (msg);
                 zsys_info("%s has joined the network", name);
+                zregistry_update (connected, peer, name);
+                free (peer);
+                free (name);
+            }
             else
-            if (streq (event, "EXIT"))
+            if (zframe_streq (event, "EXIT")) {
+                char *peer = zmsg_popstr (msg);
+                char *name = zmsg_popstr (msg);
                 zsys_info("%s has left the network", name);
-
-            free (event);
-            free (peer);
-            free (name);
-            free (group);
-            free (message);
+                zregistry_delete (connected, peer);
+                //  Zyre forgot the peer. If the registry still lists it, it
+                //  went away through a partition or a timeout rather than
+                //  by leaving, and no registry event will bring it back.
+                const char *required_endpoint = (const char *) zregistry_lookup (required, peer);
+                if (required_endpoint) {
+                    char *peer_endpoint = strdup (required_endpoint);
+                    char *public_key = public_key_from_endpoint (peer_endpoint);
+                    zsys_debug("Requiring peer again: uuid='%s' endpoint='%s'", peer, peer_endpoint);
+                    zyre_require_peer (node, peer, peer_endpoint, public_key);
+                    peers_required++;
+                    free (peer_endpoint);
+                }
+                free (peer);
+                free (name);
+            }
+            zframe_destroy (&event);
             zmsg_destroy (&msg);
         }
         else
         if (which == zsimpledisco_socket (disco)) {
             zmsg_t *msg = zmsg_recv (which);
+            char *disco_event = zmsg_popstr (msg);
             char *new_endpoint = zmsg_popstr (msg);
             char *new_uuid = zmsg_popstr (msg);
-            zsys_debug("Discovered peer: uuid='%s' endpoint='%s'", new_uuid, new_endpoint);
-            char *public_key = public_key_from_endpoint(new_endpoint);
-            if(strneq(endpoint, new_endpoint) && strneq(uuid, new_uuid)) {
-                zyre_require_peer (node, new_uuid, new_endpoint, public_key);
-                maybe_create_untrusted_key(certstore, certstore_untrusted, public_key_dir_path, untrusted_public_key_dir_path, public_key);
+            //  Forget the uuid the endpoint had, unless it is still the same
+            const char *old_uuid = (const char *) zregistry_lookup(required_uuids, new_endpoint);
+            if(old_uuid && (streq(disco_event, "REMOVED") || strneq(old_uuid, new_uuid))) {
+                const char *required_endpoint = (const char *) zregistry_lookup(required, old_uuid);
+                if(required_endpoint && streq(required_endpoint, new_endpoint))
+                    zregistry_delete(required, old_uuid);
+                zregistry_delete(required_uuids, new_endpoint);
             }
+            if (streq (disco_event, "REMOVED"))
+                zsys_debug("Peer no longer registered: uuid='%s' endpoint='%s'", new_uuid, new_endpoint);
+            else {
+                zregistry_update(required_uuids, new_endpoint, new_uuid);
+                //  Only new peers, and peers that moved, are worth a require
+                const char *required_endpoint = (const char *) zregistry_lookup(required, new_uuid);
+                if(!required_endpoint || strneq(required_endpoint, new_endpoint)) {
+                    zsys_debug("Discovered peer: uuid='%s' endpoint='%s'", new_uuid, new_endpoint);
+                    zregistry_update(required, new_uuid, new_endpoint);
+                    char *public_key = public_key_from_endpoint(new_endpoint);
+                    if(strneq(endpoint, new_endpoint) && strneq(uuid, new_uuid)) {
+                        zyre_require_peer (node, new_uuid, new_endpoint, public_key);
+                        peers_required++;
+                        maybe_create_untrusted_key(known_keys, untrusted_public_key_dir_path, public_key);
+                    }
+                }
+            }
+            free (disco_event);
             free (new_endpoint);
             free (new_uuid);
             zmsg_destroy (&msg);
@@ -264,6 +692,7 @@ gateway_actor (zsock_t *pipe, void *args)
             //zmsg_print(msg);
             zframe_t *routing_id = zmsg_pop(msg);
             char *command = zmsg_popstr (msg);
+            control_messages++;
             if (streq (command, "SUB")) {
                 char *group = zmsg_popstr (msg);
                 zsys_debug("Joining %s", group);
@@ -272,22 +701,79 @@ gateway_actor (zsock_t *pipe, void *args)
             }
             else
             if (streq (command, "PUB")) {
+                //  Whatever follows the group is the payload, sent on as
+                //  binary frames: local subscribers first, then zyre, which
+                //  takes the message over
                 char *group = zmsg_popstr (msg);
-                char *str = zmsg_popstr (msg);
-                //zsys_debug("pub->zyre %s: %s", group, str);
-                zyre_shouts (node, group, "%s", str);
-                zstr_sendx (pub, group, "local", str, NULL);
+                if (group && zmsg_size (msg)) {
+                    gateway_publish_local (pub_out, group, msg);
+                    gateway_shout (node, &zyre_stats, group, &msg);
+                }
                 free(group);
-                free(str);
+            }
+            else
+            if (streq (command, "PUBN")) {
+                //  Pairs of group and single frame payload
+                gateway_publish_batch (node, &zyre_stats, pub_out, msg);
             }
             zframe_destroy(&routing_id);
             zstr_free(&command);
             zmsg_destroy(&msg);
         }
+        else
+        if (metrics && which == metrics) {
+            char *extra = zsys_sprintf(
+                "# HELP gateway_shouts_forwarded_total Zyre shouts forwarded to the PUB socket\n"
+                "# TYPE gateway_shouts_forwarded_total counter\n"
+                "gateway_shouts_forwarded_total %" PRIu64 "\n"
+                "# HELP gateway_control_messages_total Messages received on the control socket\n"
+                "# TYPE gateway_control_messages_total counter\n"
+                "gateway_control_messages_total %" PRIu64 "\n"
+                "# HELP gateway_socket_messages_total Messages through each gateway socket\n"
+                "# TYPE gateway_socket_messages_total counter\n"
+                "gateway_socket_messages_total{socket=\"zyre\",direction=\"in\"} %" PRIu64 "\n"
+                "gateway_socket_messages_total{socket=\"zyre\",direction=\"out\"} %" PRIu64 "\n"
+                "gateway_socket_messages_total{socket=\"pub\",direction=\"out\"} %" PRIu64 "\n"
+                "# HELP gateway_socket_dropped_total Messages dropped because the socket had no room, for pub only with PUB_NODROP\n"
+                "# TYPE gateway_socket_dropped_total counter\n"
+                "gateway_socket_dropped_total{socket=\"zyre\"} %" PRIu64 "\n"
+                "gateway_socket_dropped_total{socket=\"pub\"} %" PRIu64 "\n"
+                "# HELP gateway_pub_conflated_total Messages of conflated groups replaced by a newer one before they went out\n"
+                "# TYPE gateway_pub_conflated_total counter\n"
+                "gateway_pub_conflated_total %" PRIu64 "\n"
+                "# HELP gateway_pub_pending Messages of conflated groups waiting for a subscriber to have room\n"
+                "# TYPE gateway_pub_pending gauge\n"
+                "gateway_pub_pending %zu\n"
+                "# HELP gateway_peers_required_total Calls to zyre_require_peer\n"
+                "# TYPE gateway_peers_required_total counter\n"
+                "gateway_peers_required_total %" PRIu64 "\n"
+                "# HELP gateway_required_peers Peers required at their current endpoint\n"
+                "# TYPE gateway_required_peers gauge\n"
+                "gateway_required_peers %zu\n"
+                "# HELP gateway_connected_peers Peers zyre is connected to\n"
+                "# TYPE gateway_connected_peers gauge\n"
+                "gateway_connected_peers %zu\n",
+                shouts_forwarded, control_messages,
+                zyre_stats.in, zyre_stats.out, pub_out->stats.out,
+                zyre_stats.dropped, pub_out->stats.dropped,
+                pub_out->replaced, zregistry_size(pub_out->pending),
+                peers_required, zregistry_size(required), zregistry_size(connected));
+            zsimpledisco_serve_stats(disco, metrics, extra);
+            zstr_free(&extra);
+        }
 
-        if(zclock_mono() - last_bootstrap > 30*1000) {
-            bootstrap_simpledisco(disco, certstore);
-            last_bootstrap = zclock_mono();
+        pending = gateway_pub_flush(pub_out);
+
+        //  zcertstore_certs doesn't look at the disk again, so a change
+        //  means a fresh store
+        if(zclock_mono() >= certstore_check_at) {
+            certstore_check_at = zclock_mono() + 1000;
+            if(zdirwatch_changed(certstore_watch)) {
+                zcertstore_destroy(&certstore);
+                certstore = zcertstore_new(public_key_dir_path);
+                assert(certstore);
+                bootstrap_simpledisco(disco, certstore, servers, known_keys);
+            }
         }
         if(zclock_mono() - last_zyre_dump > 60*1000) {
             zyre_print(node);
@@ -297,6 +783,14 @@ gateway_actor (zsock_t *pipe, void *args)
 
     }
     zpoller_destroy (&poller);
+    zsock_destroy (&metrics);
+    gateway_pub_destroy (&pub_out);
+    known_keys_destroy (&known_keys);
+    zregistry_destroy (&servers);
+    zregistry_destroy (&required);
+    zregistry_destroy (&required_uuids);
+    zregistry_destroy (&connected);
+    zdirwatch_destroy (&certstore_watch);
     zyre_stop (node);
     zclock_sleep (100);
     zyre_destroy (&node);
@@ -5,4 +5,24 @@ int server_cmd(char *bind);
 int keygen_cmd(const char *keypair_filename);
 int gateway_cmd (char *node_name);
 
+//  Messages through one of the gateway's sockets
+typedef struct {
+    uint64_t in;
+    uint64_t out;
+    uint64_t dropped;
+} gateway_socket_stats_t;
+
+typedef struct _gateway_pub_t gateway_pub_t;
+struct _zyre_t;
+
+gateway_pub_t *gateway_pub_new(zsock_t *sock, bool nodrop, const char *conflate_groups);
+void gateway_pub_destroy(gateway_pub_t **self_p);
+int gateway_pub_send(gateway_pub_t *self, zmsg_t *msg);
+size_t gateway_pub_flush(gateway_pub_t *self);
+int gateway_forward_shout(zmsg_t **msg_p, gateway_pub_t *pub);
+void gateway_publish_local(gateway_pub_t *pub, const char *group, zmsg_t *payload);
+int gateway_shout(struct _zyre_t *node, gateway_socket_stats_t *stats, const char *group, zmsg_t **msg_p);
+int gateway_publish_batch(struct _zyre_t *node, gateway_socket_stats_t *zyre_stats,
+    gateway_pub_t *pub, zmsg_t *pairs);
+
 #endif
@@ -16,6 +16,17 @@ void usage(char *cmd)
         "DISABLE_CURVE        unset                 set to disable curve encryption for sockets\n"
         "PUBSUB_ENDPOINT      tcp://127.0.0.1:14000 the endpoint that the gateway should bind to for pubsub\n" 
         "CONTROL_ENDPOINT     tcp://127.0.0.1:14001 the endpoint that the gateway should bind to for control\n"
+        "METRICS_ENDPOINT     unset                 endpoint serving Prometheus metrics over HTTP, e.g. tcp://*:9100\n"
+        "PUB_SNDHWM           1000                  messages queued per subscriber before it misses messages\n"
+        "PUB_NODROP           0                     set to 1 to count messages a subscriber has no room for; they are then dropped for every subscriber\n"
+        "PUB_SNDBUF           unset                 kernel send buffer size of the pubsub socket, in bytes\n"
+        "CONTROL_RCVHWM       1000                  messages queued per control client before it blocks\n"
+        "CONTROL_RCVBUF       unset                 kernel receive buffer size of the control socket, in bytes\n"
+        "ZYRE_HWM             unset                 high-water mark of the zyre and disco client sockets\n"
+        "CONFLATE_GROUPS      unset                 space separated groups where subscribers only need the latest message, needs PUB_NODROP\n"
+        "STATE_PATH           unset                 file the disco server saves its registry to for fast restarts\n"
+        "IO_THREADS           1                     ZMQ I/O threads of the disco server, these do the CURVE crypto\n"
+        "REPLICATE_ENDPOINTS  unset                 space separated endpoint|public_key list of disco servers to replicate with\n"
 
     );
     exit (1);
@@ -0,0 +1,21 @@
+//  Runs the self tests of the classes that have one. -v for verbose output.
+
+#include "czmq_library.h"
+#include "zsimpledisco.h"
+#include "zregistry.h"
+#include "zexpiry.h"
+#include "zslab.h"
+#include "zdirwatch.h"
+
+int main (int argn, char *argv [])
+{
+    bool verbose = argn == 2 && streq (argv [1], "-v");
+    printf ("Running self tests...\n");
+    zregistry_test (verbose);
+    zexpiry_test (verbose);
+    zslab_test (verbose);
+    zdirwatch_test (verbose);
+    zsimpledisco_test (verbose);
+    printf ("Tests passed OK\n");
+    return 0;
+}
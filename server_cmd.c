@@ -4,12 +4,23 @@
 
 int server_cmd(char *bind_endpoint)
 {
+    //  CURVE encryption and decryption run on the ZMQ I/O threads, so more
+    //  of them spread busy servers across cores. Must precede any socket.
+    const char *io_threads = getenv("IO_THREADS");
+    if(io_threads && atoi(io_threads) > 0) {
+        zsys_info("zsimpledisco: Using %d I/O threads", atoi(io_threads));
+        zsys_set_io_threads((size_t) atoi(io_threads));
+    }
+
     zsimpledisco_t *disco = zsimpledisco_new();
     zsimpledisco_verbose(disco);
 
     const char *certstore_path = getenv("PUBLIC_KEY_DIR_PATH");
     const char *private_key_path = getenv("PRIVATE_KEY_PATH");
     const char *disable_curve = getenv("DISABLE_CURVE");
+    const char *state_path = getenv("STATE_PATH");
+    const char *replicate_endpoints = getenv("REPLICATE_ENDPOINTS");
+    const char *metrics_endpoint = getenv("METRICS_ENDPOINT");
 
     if(!certstore_path) {
         certstore_path = "public_keys";
@@ -33,16 +44,48 @@ int server_cmd(char *bind_endpoint)
         zsys_info("zsimpledisco: curve crypto disabled using DISABLE_CURVE");
     }
 
+    if(state_path) {
+        zsys_info("zsimpledisco: Keeping registry state in %s", state_path);
+        zsimpledisco_set_state_path(disco, state_path);
+    }
+
     zsimpledisco_bind(disco, bind_endpoint);
 
+    if(replicate_endpoints) {
+        char *endpoints = strdup(replicate_endpoints);
+        char *saveptr = NULL;
+        char *endpoint;
+        for (endpoint = strtok_r(endpoints, " ", &saveptr); endpoint; endpoint = strtok_r(NULL, " ", &saveptr)) {
+            zsys_info("zsimpledisco: Replicating with %s", endpoint);
+            zsimpledisco_replicate(disco, endpoint);
+        }
+        free(endpoints);
+    }
+
     zpoller_t *poller = zpoller_new (NULL);
     zpoller_add(poller, zsimpledisco_socket(disco));
 
+    zsock_t *metrics = NULL;
+    if(metrics_endpoint) {
+        metrics = zsock_new(ZMQ_STREAM);
+        if(-1 == zsock_bind(metrics, "%s", metrics_endpoint)) {
+            zsys_error("zsimpledisco: could not bind METRICS_ENDPOINT %s", metrics_endpoint);
+            zsock_destroy(&metrics);
+        }
+        else {
+            zsys_info("zsimpledisco: Serving metrics on %s", metrics_endpoint);
+            zpoller_add(poller, metrics);
+        }
+    }
+
     while(1) {
-        zpoller_wait (poller, 1000);
+        void *which = zpoller_wait (poller, 1000);
         if(zpoller_terminated(poller))
             break;
+        if(metrics && which == metrics)
+            zsimpledisco_serve_stats(disco, metrics, NULL);
     }
+    zsock_destroy(&metrics);
     zsimpledisco_destroy(&disco);
     return 0;
 }
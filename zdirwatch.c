@@ -0,0 +1,93 @@
+#include "czmq_library.h"
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include "zdirwatch.h"
+
+struct _zdirwatch_t {
+    char *path;
+    int fd;                     //  inotify descriptor, -1 if none
+    time_t mtime;               //  Without inotify, the last mtime seen
+};
+
+zdirwatch_t *
+zdirwatch_new (const char *path)
+{
+    zdirwatch_t *self = (zdirwatch_t *) zmalloc (sizeof (zdirwatch_t));
+    assert (self);
+    self->path = strdup (path);
+    self->fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+    if (self->fd >= 0
+    &&  inotify_add_watch (self->fd, path, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ATTRIB) < 0) {
+        close (self->fd);
+        self->fd = -1;
+    }
+    if (self->fd < 0) {
+        zsys_warning ("zdirwatch: can't watch %s, checking its mtime instead", path);
+        struct stat st;
+        if (stat (path, &st) == 0)
+            self->mtime = st.st_mtime;
+    }
+    return self;
+}
+
+void
+zdirwatch_destroy (zdirwatch_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zdirwatch_t *self = *self_p;
+        if (self->fd >= 0)
+            close (self->fd);
+        zstr_free (&self->path);
+        freen (self);
+        *self_p = NULL;
+    }
+}
+
+bool
+zdirwatch_changed (zdirwatch_t *self)
+{
+    assert (self);
+    bool changed = false;
+    if (self->fd >= 0) {
+        char events [4096];
+        while (read (self->fd, events, sizeof (events)) > 0)
+            changed = true;
+    }
+    else {
+        struct stat st;
+        if (stat (self->path, &st) == 0 && st.st_mtime != self->mtime) {
+            self->mtime = st.st_mtime;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+void
+zdirwatch_test (bool verbose)
+{
+    printf (" * zdirwatch: ");
+    char *path = zsys_sprintf ("/tmp/zdirwatch-test-%d", getpid ());
+    zsys_dir_create ("%s", path);
+    zdirwatch_t *watch = zdirwatch_new (path);
+    assert (!zdirwatch_changed (watch));
+
+    char *file_path = zsys_sprintf ("%s/cert", path);
+    FILE *file = fopen (file_path, "w");
+    assert (file);
+    fclose (file);
+    assert (zdirwatch_changed (watch));
+    assert (!zdirwatch_changed (watch));
+
+    unlink (file_path);
+    assert (zdirwatch_changed (watch));
+    if (verbose)
+        zsys_debug ("zdirwatch: watched %s with %s", path, watch->fd >= 0 ? "inotify" : "mtime");
+
+    zdirwatch_destroy (&watch);
+    zsys_dir_delete ("%s", path);
+    zstr_free (&file_path);
+    zstr_free (&path);
+    printf ("OK\n");
+}
@@ -0,0 +1,32 @@
+#ifndef __ZDIRWATCH_H_INCLUDED__
+#define __ZDIRWATCH_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Tells whether the files in a directory changed, such as a cert directory
+//  being edited. Uses inotify, or compares the directory mtime where inotify
+//  is unavailable. Either way a check is one read() or stat() and doesn't
+//  walk the directory.
+typedef struct _zdirwatch_t zdirwatch_t;
+
+CZMQ_EXPORT zdirwatch_t *
+    zdirwatch_new (const char *path);
+
+CZMQ_EXPORT void
+    zdirwatch_destroy (zdirwatch_t **self_p);
+
+//  True if the directory changed since zdirwatch_new or the last call
+CZMQ_EXPORT bool
+    zdirwatch_changed (zdirwatch_t *self);
+
+//  Self test of this class
+CZMQ_EXPORT void
+    zdirwatch_test (bool verbose);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
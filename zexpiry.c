@@ -0,0 +1,201 @@
+#include "czmq_library.h"
+#include "zexpiry.h"
+
+typedef struct {
+    int64_t deadline;
+    void *item;
+    size_t *slot;               //  Holds index + 1 of this entry
+} entry_t;
+
+struct _zexpiry_t {
+    entry_t *entries;
+    size_t size;
+    size_t capacity;
+};
+
+zexpiry_t *
+zexpiry_new (void)
+{
+    zexpiry_t *self = (zexpiry_t *) zmalloc (sizeof (zexpiry_t));
+    assert (self);
+    return self;
+}
+
+void
+zexpiry_destroy (zexpiry_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zexpiry_t *self = *self_p;
+        free (self->entries);
+        freen (self);
+        *self_p = NULL;
+    }
+}
+
+static void
+s_place (zexpiry_t *self, size_t index, entry_t entry)
+{
+    self->entries [index] = entry;
+    *entry.slot = index + 1;
+}
+
+static void
+s_sift_up (zexpiry_t *self, size_t index)
+{
+    entry_t entry = self->entries [index];
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (self->entries [parent].deadline <= entry.deadline)
+            break;
+        s_place (self, index, self->entries [parent]);
+        index = parent;
+    }
+    s_place (self, index, entry);
+}
+
+static void
+s_sift_down (zexpiry_t *self, size_t index)
+{
+    entry_t entry = self->entries [index];
+    while (true) {
+        size_t child = 2 * index + 1;
+        if (child >= self->size)
+            break;
+        if (child + 1 < self->size
+        &&  self->entries [child + 1].deadline < self->entries [child].deadline)
+            child++;
+        if (entry.deadline <= self->entries [child].deadline)
+            break;
+        s_place (self, index, self->entries [child]);
+        index = child;
+    }
+    s_place (self, index, entry);
+}
+
+void
+zexpiry_set (zexpiry_t *self, void *item, size_t *slot, int64_t deadline)
+{
+    assert (self);
+    assert (slot);
+    if (*slot) {
+        size_t index = *slot - 1;
+        assert (index < self->size && self->entries [index].slot == slot);
+        int64_t old_deadline = self->entries [index].deadline;
+        self->entries [index].deadline = deadline;
+        self->entries [index].item = item;
+        if (deadline < old_deadline)
+            s_sift_up (self, index);
+        else
+            s_sift_down (self, index);
+        return;
+    }
+    if (self->size == self->capacity) {
+        self->capacity = self->capacity ? self->capacity * 2 : 64;
+        self->entries = (entry_t *) realloc (self->entries, self->capacity * sizeof (entry_t));
+        assert (self->entries);
+    }
+    entry_t entry = { deadline, item, slot };
+    s_place (self, self->size++, entry);
+    s_sift_up (self, self->size - 1);
+}
+
+void
+zexpiry_remove (zexpiry_t *self, size_t *slot)
+{
+    assert (self);
+    assert (slot);
+    if (!*slot)
+        return;
+    size_t index = *slot - 1;
+    assert (index < self->size && self->entries [index].slot == slot);
+    *slot = 0;
+    self->size--;
+    if (index == self->size)
+        return;
+    int64_t removed_deadline = self->entries [index].deadline;
+    s_place (self, index, self->entries [self->size]);
+    if (self->entries [index].deadline < removed_deadline)
+        s_sift_up (self, index);
+    else
+        s_sift_down (self, index);
+}
+
+void *
+zexpiry_pop_expired (zexpiry_t *self, int64_t now)
+{
+    assert (self);
+    if (self->size == 0 || self->entries [0].deadline >= now)
+        return NULL;
+    void *item = self->entries [0].item;
+    zexpiry_remove (self, self->entries [0].slot);
+    return item;
+}
+
+int64_t
+zexpiry_next_deadline (zexpiry_t *self)
+{
+    assert (self);
+    return self->size ? self->entries [0].deadline : -1;
+}
+
+size_t
+zexpiry_size (zexpiry_t *self)
+{
+    assert (self);
+    return self->size;
+}
+
+typedef struct {
+    int id;
+    size_t slot;
+} test_item_t;
+
+void
+zexpiry_test (bool verbose)
+{
+    printf (" * zexpiry: ");
+    zexpiry_t *self = zexpiry_new ();
+    test_item_t items [100];
+    int index;
+    //  Inserted latest first, past the initial capacity
+    for (index = 0; index < 100; index++) {
+        items [index].id = index;
+        items [index].slot = 0;
+        zexpiry_set (self, &items [index], &items [index].slot, 1000 - index);
+    }
+    assert (zexpiry_size (self) == 100);
+    assert (zexpiry_next_deadline (self) == 901);
+
+    //  Moving a deadline reorders the heap either way
+    zexpiry_set (self, &items [0], &items [0].slot, 0);
+    assert (zexpiry_next_deadline (self) == 0);
+    zexpiry_set (self, &items [0], &items [0].slot, 2000);
+    assert (zexpiry_next_deadline (self) == 901);
+    zexpiry_set (self, &items [50], &items [50].slot, 100);
+    zexpiry_remove (self, &items [99].slot);
+    assert (items [99].slot == 0);
+    assert (zexpiry_size (self) == 99);
+
+    assert (zexpiry_pop_expired (self, 100) == NULL);
+    test_item_t *item = (test_item_t *) zexpiry_pop_expired (self, 101);
+    assert (item == &items [50] && item->slot == 0);
+    int64_t previous = 0;
+    int popped = 1;
+    while ((item = (test_item_t *) zexpiry_pop_expired (self, 1001))) {
+        int64_t deadline = 1000 - item->id;
+        assert (deadline >= previous && item->id != 99 && item->id != 0);
+        assert (item->slot == 0);
+        previous = deadline;
+        popped++;
+    }
+    assert (popped == 98);
+    assert (zexpiry_next_deadline (self) == 2000);
+    assert (zexpiry_pop_expired (self, INT64_MAX) == &items [0]);
+    assert (zexpiry_next_deadline (self) == -1);
+
+    if (verbose)
+        zsys_debug ("zexpiry: popped %d items in deadline order", popped + 1);
+    zexpiry_destroy (&self);
+    printf ("OK\n");
+}
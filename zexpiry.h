@@ -0,0 +1,45 @@
+#ifndef __ZEXPIRY_H_INCLUDED__
+#define __ZEXPIRY_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Min-heap of items ordered by deadline. Each item owns a size_t slot that
+//  the heap keeps pointing at the item's position, so moving or removing an
+//  item never has to search for it. A slot of 0 means "not in the heap".
+typedef struct _zexpiry_t zexpiry_t;
+
+CZMQ_EXPORT zexpiry_t *
+    zexpiry_new (void);
+
+CZMQ_EXPORT void
+    zexpiry_destroy (zexpiry_t **self_p);
+
+//  Insert item, or move it if its slot says it is already in the heap
+CZMQ_EXPORT void
+    zexpiry_set (zexpiry_t *self, void *item, size_t *slot, int64_t deadline);
+
+CZMQ_EXPORT void
+    zexpiry_remove (zexpiry_t *self, size_t *slot);
+
+//  Remove and return one item whose deadline is before now, or NULL
+CZMQ_EXPORT void *
+    zexpiry_pop_expired (zexpiry_t *self, int64_t now);
+
+//  Earliest deadline in the heap, or -1 when it is empty
+CZMQ_EXPORT int64_t
+    zexpiry_next_deadline (zexpiry_t *self);
+
+CZMQ_EXPORT size_t
+    zexpiry_size (zexpiry_t *self);
+
+//  Self test of this class
+CZMQ_EXPORT void
+    zexpiry_test (bool verbose);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
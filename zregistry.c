@@ -0,0 +1,490 @@
+#include "czmq_library.h"
+#include "zregistry.h"
+
+//  Hash slot markers, real hashes are never below SLOT_USED
+#define SLOT_EMPTY      0
+#define SLOT_DELETED    1
+#define SLOT_USED       2
+
+#define INITIAL_CAPACITY 16
+
+typedef struct {
+    void *item;
+    char *heap_key;             //  Set when the key does not fit inline
+    char inline_key [ZREGISTRY_INLINE_KEY];
+} entry_t;
+
+struct _zregistry_t {
+    uint32_t *hashes;           //  One per slot, probed before touching entries
+    entry_t *entries;
+    size_t capacity;            //  Always a power of two
+    size_t size;                //  Live items
+    size_t used;                //  Live and deleted slots
+    size_t cursor;              //  Slot of the item last returned by first/next
+    bool autofree;
+    zregistry_free_fn *destructor;
+};
+
+static uint32_t
+s_hash (const char *key)
+{
+    //  FNV-1a
+    uint32_t hash = 2166136261u;
+    while (*key) {
+        hash ^= (unsigned char) *key++;
+        hash *= 16777619u;
+    }
+    return hash < SLOT_USED? hash + SLOT_USED: hash;
+}
+
+static const char *
+s_entry_key (entry_t *entry)
+{
+    return entry->heap_key? entry->heap_key: entry->inline_key;
+}
+
+static void
+s_alloc_slots (zregistry_t *self, size_t capacity)
+{
+    self->hashes = (uint32_t *) zmalloc (capacity * sizeof (uint32_t));
+    self->entries = (entry_t *) malloc (capacity * sizeof (entry_t));
+    assert (self->hashes && self->entries);
+    self->capacity = capacity;
+    self->used = self->size;
+}
+
+zregistry_t *
+zregistry_new (void)
+{
+    zregistry_t *self = (zregistry_t *) zmalloc (sizeof (zregistry_t));
+    assert (self);
+    s_alloc_slots (self, INITIAL_CAPACITY);
+    return self;
+}
+
+static void
+s_free_item (zregistry_t *self, void *item)
+{
+    if (self->autofree)
+        free (item);
+    else
+    if (self->destructor)
+        self->destructor (item);
+}
+
+void
+zregistry_destroy (zregistry_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zregistry_t *self = *self_p;
+        size_t index;
+        for (index = 0; index < self->capacity; index++) {
+            if (self->hashes [index] >= SLOT_USED) {
+                s_free_item (self, self->entries [index].item);
+                free (self->entries [index].heap_key);
+            }
+        }
+        free (self->hashes);
+        free (self->entries);
+        freen (self);
+        *self_p = NULL;
+    }
+}
+
+void
+zregistry_autofree (zregistry_t *self)
+{
+    assert (self);
+    self->autofree = true;
+}
+
+void
+zregistry_set_destructor (zregistry_t *self, zregistry_free_fn *fn)
+{
+    assert (self);
+    self->destructor = fn;
+}
+
+//  Slot holding key, or the slot a new key should go in when absent
+static size_t
+s_find (zregistry_t *self, const char *key, uint32_t hash, bool *found)
+{
+    size_t mask = self->capacity - 1;
+    size_t index = hash & mask;
+    size_t free_slot = self->capacity;
+    while (true) {
+        uint32_t slot_hash = self->hashes [index];
+        if (slot_hash == SLOT_EMPTY) {
+            *found = false;
+            return free_slot < self->capacity? free_slot: index;
+        }
+        if (slot_hash == SLOT_DELETED) {
+            if (free_slot == self->capacity)
+                free_slot = index;
+        }
+        else
+        if (slot_hash == hash && streq (s_entry_key (&self->entries [index]), key)) {
+            *found = true;
+            return index;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+static void
+s_rehash (zregistry_t *self, size_t capacity)
+{
+    uint32_t *old_hashes = self->hashes;
+    entry_t *old_entries = self->entries;
+    size_t old_capacity = self->capacity;
+    s_alloc_slots (self, capacity);
+
+    size_t index;
+    for (index = 0; index < old_capacity; index++) {
+        if (old_hashes [index] < SLOT_USED)
+            continue;
+        size_t slot = old_hashes [index] & (capacity - 1);
+        while (self->hashes [slot] != SLOT_EMPTY)
+            slot = (slot + 1) & (capacity - 1);
+        self->hashes [slot] = old_hashes [index];
+        self->entries [slot] = old_entries [index];
+    }
+    free (old_hashes);
+    free (old_entries);
+}
+
+static void
+s_store (zregistry_t *self, size_t index, uint32_t hash, const char *key, void *item)
+{
+    entry_t *entry = &self->entries [index];
+    size_t length = strlen (key);
+    if (length < ZREGISTRY_INLINE_KEY) {
+        memcpy (entry->inline_key, key, length + 1);
+        entry->heap_key = NULL;
+    }
+    else {
+        entry->heap_key = strdup (key);
+        assert (entry->heap_key);
+    }
+    entry->item = self->autofree? strdup ((char *) item): item;
+    if (self->hashes [index] == SLOT_EMPTY)
+        self->used++;
+    self->hashes [index] = hash;
+    self->size++;
+}
+
+static void
+s_make_room (zregistry_t *self)
+{
+    //  Keep the load, counting deleted slots, under 3/4
+    if ((self->used + 1) * 4 > self->capacity * 3) {
+        size_t capacity = self->capacity;
+        while ((self->size + 1) * 2 > capacity)
+            capacity *= 2;
+        s_rehash (self, capacity);
+    }
+}
+
+//  Store a key s_find did not find. Only a new key can grow the table, so
+//  the slot is looked up again when it did.
+static void
+s_store_new (zregistry_t *self, size_t index, uint32_t hash, const char *key, void *item)
+{
+    size_t capacity = self->capacity;
+    s_make_room (self);
+    if (self->capacity != capacity) {
+        bool found;
+        index = s_find (self, key, hash, &found);
+    }
+    s_store (self, index, hash, key, item);
+}
+
+int
+zregistry_insert (zregistry_t *self, const char *key, void *item)
+{
+    assert (self);
+    assert (key);
+    uint32_t hash = s_hash (key);
+    bool found;
+    size_t index = s_find (self, key, hash, &found);
+    if (found)
+        return -1;
+    s_store_new (self, index, hash, key, item);
+    return 0;
+}
+
+void
+zregistry_update (zregistry_t *self, const char *key, void *item)
+{
+    assert (self);
+    assert (key);
+    uint32_t hash = s_hash (key);
+    bool found;
+    size_t index = s_find (self, key, hash, &found);
+    if (found) {
+        entry_t *entry = &self->entries [index];
+        void *old_item = entry->item;
+        entry->item = self->autofree? strdup ((char *) item): item;
+        s_free_item (self, old_item);
+    }
+    else
+        s_store_new (self, index, hash, key, item);
+}
+
+void
+zregistry_delete (zregistry_t *self, const char *key)
+{
+    assert (self);
+    assert (key);
+    bool found;
+    size_t index = s_find (self, key, s_hash (key), &found);
+    if (!found)
+        return;
+    entry_t *entry = &self->entries [index];
+    self->hashes [index] = SLOT_DELETED;
+    self->size--;
+    s_free_item (self, entry->item);
+    entry->item = NULL;
+    //  The key may be the caller's cursor, so the slot keeps it readable
+    //  until it is reused; only a heap copy is released
+    if (entry->heap_key) {
+        size_t length = strlen (entry->heap_key);
+        if (length >= ZREGISTRY_INLINE_KEY)
+            length = ZREGISTRY_INLINE_KEY - 1;
+        memcpy (entry->inline_key, entry->heap_key, length);
+        entry->inline_key [length] = 0;
+        zstr_free (&entry->heap_key);
+    }
+}
+
+void *
+zregistry_lookup (zregistry_t *self, const char *key)
+{
+    assert (self);
+    assert (key);
+    bool found;
+    size_t index = s_find (self, key, s_hash (key), &found);
+    return found? self->entries [index].item: NULL;
+}
+
+size_t
+zregistry_size (zregistry_t *self)
+{
+    assert (self);
+    return self->size;
+}
+
+static void *
+s_seek (zregistry_t *self, size_t index)
+{
+    for (; index < self->capacity; index++) {
+        if (self->hashes [index] >= SLOT_USED) {
+            self->cursor = index;
+            return self->entries [index].item;
+        }
+    }
+    self->cursor = self->capacity;
+    return NULL;
+}
+
+void *
+zregistry_first (zregistry_t *self)
+{
+    assert (self);
+    return s_seek (self, 0);
+}
+
+void *
+zregistry_next (zregistry_t *self)
+{
+    assert (self);
+    if (self->cursor >= self->capacity)
+        return NULL;
+    return s_seek (self, self->cursor + 1);
+}
+
+const char *
+zregistry_cursor (zregistry_t *self)
+{
+    assert (self);
+    if (self->cursor >= self->capacity)
+        return NULL;
+    return s_entry_key (&self->entries [self->cursor]);
+}
+
+zframe_t *
+zregistry_pack (zregistry_t *self, zregistry_value_fn *value_fn)
+{
+    assert (self);
+    //  First pass sizes the frame, keys are short strings so longer ones are skipped
+    size_t frame_size = 4;
+    uint32_t count = 0;
+    size_t index;
+    for (index = 0; index < self->capacity; index++) {
+        if (self->hashes [index] < SLOT_USED)
+            continue;
+        entry_t *entry = &self->entries [index];
+        const char *value = value_fn? value_fn (entry->item): (const char *) entry->item;
+        size_t key_length = strlen (s_entry_key (entry));
+        if (!value || key_length > 255)
+            continue;
+        frame_size += 1 + key_length + 4 + strlen (value);
+        count++;
+    }
+    zframe_t *frame = zframe_new (NULL, frame_size);
+    assert (frame);
+    byte *needle = zframe_data (frame);
+    *needle++ = (byte) (count >> 24);
+    *needle++ = (byte) (count >> 16);
+    *needle++ = (byte) (count >> 8);
+    *needle++ = (byte) count;
+    for (index = 0; index < self->capacity; index++) {
+        if (self->hashes [index] < SLOT_USED)
+            continue;
+        entry_t *entry = &self->entries [index];
+        const char *value = value_fn? value_fn (entry->item): (const char *) entry->item;
+        const char *key = s_entry_key (entry);
+        size_t key_length = strlen (key);
+        if (!value || key_length > 255)
+            continue;
+        *needle++ = (byte) key_length;
+        memcpy (needle, key, key_length);
+        needle += key_length;
+        size_t value_length = strlen (value);
+        *needle++ = (byte) (value_length >> 24);
+        *needle++ = (byte) (value_length >> 16);
+        *needle++ = (byte) (value_length >> 8);
+        *needle++ = (byte) value_length;
+        memcpy (needle, value, value_length);
+        needle += value_length;
+    }
+    return frame;
+}
+
+zregistry_t *
+zregistry_unpack (zframe_t *frame)
+{
+    assert (frame);
+    byte *needle = zframe_data (frame);
+    byte *ceiling = needle + zframe_size (frame);
+    if (needle + 4 > ceiling)
+        return NULL;
+    uint32_t count = ((uint32_t) needle [0] << 24) + ((uint32_t) needle [1] << 16)
+                   + ((uint32_t) needle [2] << 8) + (uint32_t) needle [3];
+    needle += 4;
+
+    zregistry_t *self = zregistry_new ();
+    zregistry_autofree (self);
+    char key [256];
+    char *value = NULL;         //  Reused for every value, the registry keeps copies
+    size_t value_size = 0;
+    while (count--) {
+        if (needle + 1 > ceiling)
+            goto invalid;
+        size_t key_length = *needle++;
+        if (needle + key_length + 4 > ceiling)
+            goto invalid;
+        memcpy (key, needle, key_length);
+        key [key_length] = 0;
+        needle += key_length;
+        size_t value_length = ((size_t) needle [0] << 24) + ((size_t) needle [1] << 16)
+                            + ((size_t) needle [2] << 8) + (size_t) needle [3];
+        needle += 4;
+        if (value_length > (size_t) (ceiling - needle))
+            goto invalid;
+        if (value_length + 1 > value_size) {
+            value_size = value_length + 1;
+            value = (char *) realloc (value, value_size);
+            assert (value);
+        }
+        memcpy (value, needle, value_length);
+        value [value_length] = 0;
+        needle += value_length;
+        zregistry_update (self, key, value);
+    }
+    free (value);
+    return self;
+
+invalid:
+    free (value);
+    zregistry_destroy (&self);
+    return NULL;
+}
+
+void
+zregistry_test (bool verbose)
+{
+    printf (" * zregistry: ");
+    zregistry_t *self = zregistry_new ();
+    zregistry_autofree (self);
+
+    //  Grows through several load factor limits, some keys too long to
+    //  inline, and stops where one more key would grow it again
+    char key [128];
+    int index;
+    for (index = 0; index < 1000 || (self->used + 1) * 4 <= self->capacity * 3; index++) {
+        snprintf (key, sizeof (key), index % 10? "key-%d": "key-%d-%0100d", index, 0);
+        assert (zregistry_insert (self, key, key) == 0);
+    }
+    int nbr_keys = index;
+    size_t capacity = self->capacity;
+    assert (zregistry_size (self) == (size_t) nbr_keys);
+    assert (capacity > INITIAL_CAPACITY);
+    assert (self->used * 4 <= capacity * 3);
+    for (index = 0; index < nbr_keys; index++) {
+        snprintf (key, sizeof (key), index % 10? "key-%d": "key-%d-%0100d", index, 0);
+        char *item = (char *) zregistry_lookup (self, key);
+        assert (item && streq (item, key));
+        assert (zregistry_insert (self, key, "again") == -1);
+    }
+    assert (self->capacity == capacity);
+
+    //  Updating every key while iterating visits each one once, in place
+    size_t visited = 0;
+    char *item;
+    for (item = (char *) zregistry_first (self); item != NULL; item = (char *) zregistry_next (self)) {
+        zregistry_update (self, zregistry_cursor (self), "updated");
+        visited++;
+    }
+    assert (visited == (size_t) nbr_keys);
+    assert (self->capacity == capacity);
+    assert (streq ((char *) zregistry_lookup (self, "key-1"), "updated"));
+
+    //  Deleting the current item and items ahead of it skips nothing else
+    zregistry_t *seen = zregistry_new ();
+    for (item = (char *) zregistry_first (self); item != NULL; item = (char *) zregistry_next (self)) {
+        const char *cursor = zregistry_cursor (self);
+        assert (zregistry_insert (seen, cursor, item) == 0);
+        int number = atoi (cursor + strlen ("key-"));
+        if (number % 2 == 0)
+            zregistry_delete (self, cursor);
+        else
+        if (number + 1 < nbr_keys) {
+            snprintf (key, sizeof (key), (number + 1) % 10? "key-%d": "key-%d-%0100d", number + 1, 0);
+            if (!zregistry_lookup (seen, key))
+                zregistry_delete (self, key);
+        }
+    }
+    assert (zregistry_size (self) == (size_t) nbr_keys / 2);
+    for (index = 0; index < nbr_keys; index++) {
+        snprintf (key, sizeof (key), index % 10? "key-%d": "key-%d-%0100d", index, 0);
+        assert ((zregistry_lookup (self, key) != NULL) == (index % 2 == 1));
+        if (index % 2 == 1)
+            assert (zregistry_lookup (seen, key));
+    }
+    zregistry_destroy (&seen);
+
+    //  Round trip through the zhash_pack format
+    zframe_t *frame = zregistry_pack (self, NULL);
+    zregistry_t *copy = zregistry_unpack (frame);
+    assert (copy && zregistry_size (copy) == zregistry_size (self));
+    assert (streq ((char *) zregistry_lookup (copy, "key-1"), "updated"));
+    zregistry_destroy (&copy);
+    zframe_destroy (&frame);
+
+    if (verbose)
+        zsys_debug ("zregistry: %zu keys in %zu slots", zregistry_size (self), self->capacity);
+    zregistry_destroy (&self);
+    printf ("OK\n");
+}
@@ -0,0 +1,81 @@
+#ifndef __ZREGISTRY_H_INCLUDED__
+#define __ZREGISTRY_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  String keyed table of items, used in place of zhash for the registry.
+//  Open addressing over a dense array of stored hashes, so probes and
+//  iteration walk contiguous memory, with keys up to ZREGISTRY_INLINE_KEY
+//  bytes stored inline. Deleting never moves other items; inserting may.
+typedef struct _zregistry_t zregistry_t;
+
+#define ZREGISTRY_INLINE_KEY 72
+
+typedef void (zregistry_free_fn) (void *item);
+
+//  Returns the string to pack for an item
+typedef const char *(zregistry_value_fn) (void *item);
+
+CZMQ_EXPORT zregistry_t *
+    zregistry_new (void);
+
+CZMQ_EXPORT void
+    zregistry_destroy (zregistry_t **self_p);
+
+//  Items are strings, copied on insert and freed on delete, like zhash_autofree
+CZMQ_EXPORT void
+    zregistry_autofree (zregistry_t *self);
+
+//  Items are destroyed with fn on delete, update and destroy
+CZMQ_EXPORT void
+    zregistry_set_destructor (zregistry_t *self, zregistry_free_fn *fn);
+
+//  Returns -1 if the key already exists
+CZMQ_EXPORT int
+    zregistry_insert (zregistry_t *self, const char *key, void *item);
+
+CZMQ_EXPORT void
+    zregistry_update (zregistry_t *self, const char *key, void *item);
+
+CZMQ_EXPORT void
+    zregistry_delete (zregistry_t *self, const char *key);
+
+CZMQ_EXPORT void *
+    zregistry_lookup (zregistry_t *self, const char *key);
+
+CZMQ_EXPORT size_t
+    zregistry_size (zregistry_t *self);
+
+//  Iterate over the items in no particular order. The loop body may delete
+//  any item, the current one included, and update keys that exist, without
+//  skipping or repeating the others; it must not add keys.
+CZMQ_EXPORT void *
+    zregistry_first (zregistry_t *self);
+
+CZMQ_EXPORT void *
+    zregistry_next (zregistry_t *self);
+
+//  Key of the item last returned by first/next
+CZMQ_EXPORT const char *
+    zregistry_cursor (zregistry_t *self);
+
+//  Serialize in the zhash_pack wire format. Items are packed as strings,
+//  or through value_fn when it is set; NULL values are left out.
+CZMQ_EXPORT zframe_t *
+    zregistry_pack (zregistry_t *self, zregistry_value_fn *value_fn);
+
+//  Deserialize a zhash_pack frame into a new autofree registry, or NULL
+CZMQ_EXPORT zregistry_t *
+    zregistry_unpack (zframe_t *frame);
+
+//  Self test of this class
+CZMQ_EXPORT void
+    zregistry_test (bool verbose);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
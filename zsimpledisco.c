@@ -1,5 +1,74 @@
 #include "czmq_library.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include "zsimpledisco.h"
+#include "zexpiry.h"
+#include "zslab.h"
+#include "zdirwatch.h"
+
+//  Pooled string sizes are 32, 64, ... bytes, longer strings use the heap
+#define STRING_CLASSES 5
+
+//  The state file is a dump of the live server records in native byte order:
+//  a state_header_t, then for each record a state_record_t, the key and the
+//  value, without terminating nulls. Changes after the dump are appended to
+//  the state log, state_path with .log added, in batches of the same layout;
+//  a removed key has STATE_RECORD_REMOVED set and no value. Batches are
+//  numbered, and the dump has the number of the last batch it includes.
+#define STATE_FILE_MAGIC "SDSTATE2"
+#define STATE_LOG_MAGIC "SDSTLOG2"
+#define STATE_RECORD_REMOVED 1
+
+//  Servers replicating to each other compare one digest per bucket of keys
+#define SYNC_BUCKETS 256
+
+//  Server commands counted by STATS, anything else counts as the last one
+static const char *s_stats_commands [] = {
+    "PUBLISH", "PUBLISH-BATCH", "PUBLISH-BATCH-TTL", "RENEW", "WATCH", "VALUES", "VALUES SINCE",
+    "SYNC", "SYNC-PUSH", "STATS", "PING", "other"
+};
+#define STATS_COMMANDS (sizeof (s_stats_commands) / sizeof (s_stats_commands [0]))
+
+//  Upper bounds of the latency histogram buckets, in usecs
+static const int64_t s_stats_bounds [] = { 10, 50, 100, 500, 1000, 5000, 10000, 100000, 1000000 };
+#define STATS_BOUNDS (sizeof (s_stats_bounds) / sizeof (s_stats_bounds [0]))
+
+typedef struct {
+    uint64_t buckets [STATS_BOUNDS + 1];    //  Last one is everything slower
+    uint64_t count;
+    int64_t sum;                //  In usecs
+} histogram_t;
+
+//  Plain counters, cheap enough to keep without verbose
+typedef struct {
+    uint64_t requests [STATS_COMMANDS];
+    uint64_t unauthorized;      //  Messages from keys no longer allowed
+    histogram_t publish_latency;    //  Handling PUBLISH and PUBLISH-BATCH
+    histogram_t values_latency; //  Handling VALUES and VALUES SINCE
+    histogram_t loop_lag;       //  From waking up until polling again
+    uint64_t keys_expired;
+    uint64_t leases_expired;
+    uint64_t snapshot_packs;
+    uint64_t reconnects;        //  Probes of unhealthy servers by the client side
+} stats_t;
+
+typedef struct {
+    char magic [8];
+    int64_t saved;              //  Wall clock time of the save, in msecs
+    uint32_t count;             //  Number of records that follow
+    uint32_t sequence;          //  Number of the (last) log batch
+} state_header_t;
+
+typedef struct {
+    int64_t age;                //  Age of the record when saved, in msecs
+    uint32_t key_size;
+    uint32_t value_size;
+    int32_t ttl;                //  Per-key TTL in msecs, 0 for the default
+    uint32_t flags;             //  STATE_RECORD_REMOVED
+} state_record_t;
+
+typedef struct _deadline_t deadline_t;
 
 struct _zsimpledisco_t {
     zactor_t *actor;            //  A zsimpledisco instance wraps the actor instance
@@ -14,41 +83,201 @@ typedef struct {
     bool terminated;            //  Did caller ask us to quit?
     bool verbose;               //  Verbose logging enabled?
     zsock_t *server_socket;     //  Socket for talking to clients
-    int64_t last_cleanup;       //  Time records were last cleaned up
-    int64_t last_send;          //  Time records were last sent
-    int64_t last_deliver;       //  Time records were last delivered out of the actor
-    int64_t last_reconnect;     //  Time of last reconnect attempt
+    zpoller_t *poller;          //  Actor poller, includes client sockets
+    zexpiry_t *timers;          //  deadline_t timers ordered by when they are due
+    deadline_t *deliver_timer;  //  Deliver records out of the actor
+    deadline_t *send_timer;     //  Send records to the servers
+    deadline_t *cleanup_timer;  //  Expire records and watchers
     int send_interval;          //  Interval to re-send data to the server
     int deliver_interval;        //  Interval to deliver data
     int cleanup_interval;       //  Cleanup interval in seconds
-    int cleanup_max_age;        //  Cleanup records older than this many seconds
-    int reconnect_interval;     //  Interval to reconnect to unreachable hosts
+    int cleanup_max_age;        //  Cleanup records older than this many seconds, unless they have a TTL
+    int reconnect_interval;     //  Longest wait before probing an unreachable server again
     int peer_timeout;           //  Timeout for peer socket.
-    zhash_t *data;              //  key/value data, on the server
-    zhash_t *client_data;       //  key/value data, on the client
-    zhash_t *client_sockets;    //  endpoint/socket mapping of client sockets
-    zlist_t *reconnect_queue;   //  List of endpoints to attempt to reconnect to
+    zregistry_t *data;          //  key/value data, on the server
+    zregistry_t *tombstones;    //  recently expired keys, on the server
+    zexpiry_t *expiry;          //  live server records ordered by expiration time
+    zlistx_t *changes;          //  server records (live and tombstones) in generation order
+    zslab_t *record_slab;       //  Storage for server records
+    zslab_t *string_slabs [STRING_CLASSES]; //  Storage for server keys and values
+    char *epoch;                //  Identifies this server run, generations restart with it
+    uint64_t generation;        //  Bumped on every change to data
+    uint64_t oldest_generation; //  Deltas from before this are no longer possible
+    int tombstone_max_age;      //  How long expired keys are remembered for deltas
+    char *state_path;           //  File the server records are saved to, NULL if none
+    char *state_log_path;       //  Log of the changes after that
+    uint64_t state_generation;  //  Generation the state file and log are up to date with
+    uint32_t state_sequence;    //  Number of the last batch in the log
+    size_t state_size;          //  Bytes in the state file
+    size_t state_log_size;      //  Bytes in the log
+    int64_t state_compacted;    //  When the state file was last written
+    int state_save_interval;    //  Interval to save the server records
+    deadline_t *state_timer;    //  Save the server records
+    zregistry_t *replicas;      //  endpoint/peer_t mapping of servers we replicate with
+    uint64_t digests [SYNC_BUCKETS];    //  XOR of the record digests in each bucket
+    int sync_slot;              //  Timestamps are compared between servers at this granularity
+    int sync_interval;          //  Interval to compare digests with the replicas
+    deadline_t *sync_timer;     //  Send digests to the replicas
+    zregistry_t *leases;        //  id/lease_t mapping of client leases, on the server
+    zexpiry_t *lease_expiry;    //  leases ordered by expiration time
+    unsigned int lease_count;   //  Leases handed out this run, for unique ids
+    zframe_t *snapshot;         //  Packed copy of data, valid for snapshot_generation
+    uint64_t snapshot_generation;   //  Generation the snapshot was packed at
+    zregistry_t *client_data;   //  key/value data, on the client
+    zregistry_t *client_peers;  //  endpoint/peer_t mapping of client connections
+    uint64_t client_data_version;   //  Bumped whenever client_data changes
+    zregistry_t *client_ttls;   //  key/TTL in msecs of the client keys that have one
+    int client_min_ttl;         //  Shortest of client_ttls, 0 if none
+    zregistry_t *delivered;     //  key/value data as last delivered to the application
+    char *watch_prefix;         //  Prefix of keys to have pushed to us, NULL when not watching
+    zregistry_t *watchers;      //  routing id/watcher_t mapping of clients watching, on the server
 
     zactor_t *auth;             //  zauth Actor, if curve enabled
-    zcertstore_t *certstore;    //  certstore, for verififying connections
+    char *certstore_path;       //  Directory of the public keys allowed to use the server
+    zregistry_t *allowlist;     //  Public keys in certstore_path, checked on every message
+    zdirwatch_t *certstore_watch;   //  Changes to certstore_path
+    deadline_t *allowlist_timer;    //  Check certstore_path for changes
+    stats_t stats;              //  Counters for STATS
     zcert_t *private_key;       //  curve private key
 } self_t;
 
+//  Keys one client registered together with PUBLISH-BATCH. A single RENEW
+//  keeps all of them alive, and they expire together when it stops.
+typedef struct {
+    char *id;
+    int64_t ts;                 //  Time of the last RENEW, stands in for its records' ts
+    int ttl;                    //  Shortest TTL of its records, it lapses after that
+    int64_t digest_slot;        //  Wall clock slot its records' digests were computed in
+    zlistx_t *records;          //  value_t records kept alive by this lease
+    size_t expiry_slot;         //  Position in self->lease_expiry
+} lease_t;
+
+void
+lease_t_free(void *item_p)
+{
+    assert(item_p);
+    lease_t *item = item_p;
+    zlistx_destroy(&item->records);
+    free(item->id);
+    free(item);
+    item=NULL;
+}
+
 typedef struct {
-    char *value;
-    int64_t ts;
+    char *key;                  //  Own copy of the key, for walking the change list
+    char *value;                //  NULL once the key has expired
+    int64_t ts;                 //  Last refresh, unless a lease keeps it alive
+    int ttl;                    //  Expires this long after the refresh, 0 for cleanup_max_age
+    lease_t *lease;             //  Lease keeping this record alive, or NULL
+    void *lease_handle;         //  Position in lease->records
+    uint64_t generation;        //  Generation of the last change to this key
+    void *change_handle;        //  Position in self->changes
+    size_t expiry_slot;         //  Position in self->expiry
+    uint64_t digest;            //  Contribution to its bucket in self->digests
 } value_t;
 
+//  A server the client side is connected to
+typedef struct {
+    char *endpoint;             //  Endpoint as given to CONNECT, including |public_key
+    zsock_t *sock;              //  DEALER socket connected to the server
+    int pending;                //  Replies still outstanding for the current request
+    int64_t request_sent;       //  Time an unanswered SYNC was sent to a replica
+    int failures;               //  Consecutive failed requests, 0 while healthy
+    int64_t failed_since;       //  When the first of those failures happened
+    int64_t retry_at;           //  When to probe an unhealthy server again
+    int64_t probe_sent;         //  Time the unanswered PING went out, 0 if none
+    uint64_t timeouts;          //  Requests and probes it didn't answer in time
+    char *lease;                //  Lease the server gave our keys, NULL if none
+    uint64_t lease_version;     //  client_data_version the lease covers
+    char *epoch;                //  Server run our copy of its values came from
+    uint64_t generation;        //  Server generation our copy is up to date with
+    zregistry_t *values;        //  Our copy of the server's key/value data
+} peer_t;
+
+void
+peer_t_free(void *item_p)
+{
+    assert(item_p);
+    peer_t *item = item_p;
+    zsock_destroy(&item->sock);
+    zregistry_destroy(&item->values);
+    free(item->lease);
+    free(item->epoch);
+    free(item->endpoint);
+    free(item);
+    item=NULL;
+}
+
+//  A client that wants changes pushed to it
+typedef struct {
+    zframe_t *routing_id;       //  Where to send events
+    char *prefix;               //  Only keys starting with this
+    int64_t expires;            //  Forgotten unless WATCH is repeated before this
+} watcher_t;
+
 void
-value_t_free(void *item_p)
+watcher_t_free(void *item_p)
 {
     assert(item_p);
-    value_t *item = item_p;
-    free(item->value);
+    watcher_t *item = item_p;
+    zframe_destroy(&item->routing_id);
+    free(item->prefix);
     free(item);
     item=NULL;
 }
 
+//  Runs in the actor loop once a timer is due
+typedef void (s_deadline_fn) (self_t *self);
+
+struct _deadline_t {
+    s_deadline_fn *handler;
+    size_t slot;                //  Position in self->timers, 0 when not scheduled
+    bool oneshot;               //  Made by s_self_once, freed after it ran
+};
+
+static deadline_t *
+s_deadline_new(s_deadline_fn *handler)
+{
+    deadline_t *timer = (deadline_t *) zmalloc (sizeof (deadline_t));
+    timer->handler = handler;
+    return timer;
+}
+
+//  Run timer at when, or move it there if it was already scheduled
+static void
+s_self_timer_at(self_t *self, deadline_t *timer, int64_t when)
+{
+    zexpiry_set(self->timers, timer, &timer->slot, when);
+}
+
+//  Run handler once at when
+static void
+s_self_once(self_t *self, int64_t when, s_deadline_fn *handler)
+{
+    deadline_t *timer = s_deadline_new(handler);
+    timer->oneshot = true;
+    s_self_timer_at(self, timer, when);
+}
+
+//  Run every timer that is due. A timer is not rerun unless its handler
+//  schedules it again, which must be for later than now.
+static void
+s_self_run_timers(self_t *self)
+{
+    int64_t now = zclock_mono();
+    deadline_t *timer;
+    while ((timer = (deadline_t *) zexpiry_pop_expired (self->timers, now + 1))) {
+        timer->handler(self);
+        if(timer->oneshot)
+            free(timer);
+    }
+}
+
+//  Sends one request to a peer, returns the number of replies to wait for or -1
+typedef int (s_request_fn) (self_t *self, peer_t *peer, void *arg);
+//  Handles one reply from a peer
+typedef void (s_reply_fn) (self_t *self, peer_t *peer, zmsg_t *reply, void *arg);
+
 zsimpledisco_t *
 zsimpledisco_new()
 {
@@ -85,6 +314,12 @@ zsimpledisco_connect(zsimpledisco_t *self, const char *endpoint)
 	zstr_sendx (self->actor, "CONNECT", endpoint, NULL);
 }
 
+void
+zsimpledisco_disconnect(zsimpledisco_t *self, const char *endpoint)
+{
+	zstr_sendx (self->actor, "DISCONNECT", endpoint, NULL);
+}
+
 void
 zsimpledisco_bind(zsimpledisco_t *self, const char *endpoint)
 {
@@ -107,6 +342,22 @@ zsimpledisco_set_private_key_path(zsimpledisco_t *self, const char *path)
 {
 	return zstr_sendx (self->actor, "SET PRIVATE KEY PATH", path, NULL);
 }
+void
+zsimpledisco_replicate(zsimpledisco_t *self, const char *endpoint)
+{
+	zstr_sendx (self->actor, "REPLICATE", endpoint, NULL);
+}
+int
+zsimpledisco_set_state_path(zsimpledisco_t *self, const char *path)
+{
+	return zstr_sendx (self->actor, "SET STATE PATH", path, NULL);
+}
+
+void
+zsimpledisco_watch(zsimpledisco_t *self, const char *prefix)
+{
+	zstr_sendx (self->actor, "WATCH", prefix ? prefix : "", NULL);
+}
 
 void
 zsimpledisco_publish(zsimpledisco_t *self, const char *key, const char *value)
@@ -114,10 +365,93 @@ zsimpledisco_publish(zsimpledisco_t *self, const char *key, const char *value)
 	zstr_sendx (self->actor, "PUBLISH", key, value, NULL);
 }
 void
+zsimpledisco_publish_ttl(zsimpledisco_t *self, const char *key, const char *value, int ttl)
+{
+	char *ttl_str = zsys_sprintf ("%d", ttl);
+	zstr_sendx (self->actor, "PUBLISH", key, value, ttl_str, NULL);
+	zstr_free (&ttl_str);
+}
+
+static void
+s_set_interval(zsimpledisco_t *self, const char *name, int msecs)
+{
+	char *msecs_str = zsys_sprintf ("%d", msecs);
+	zstr_sendx (self->actor, "SET INTERVAL", name, msecs_str, NULL);
+	zstr_free (&msecs_str);
+}
+void
+zsimpledisco_set_deliver_interval(zsimpledisco_t *self, int msecs)
+{
+	s_set_interval (self, "deliver", msecs);
+}
+void
+zsimpledisco_set_send_interval(zsimpledisco_t *self, int msecs)
+{
+	s_set_interval (self, "send", msecs);
+}
+void
+zsimpledisco_set_cleanup_interval(zsimpledisco_t *self, int msecs)
+{
+	s_set_interval (self, "cleanup", msecs);
+}
+void
+zsimpledisco_set_max_age(zsimpledisco_t *self, int msecs)
+{
+	s_set_interval (self, "max age", msecs);
+}
+void
+zsimpledisco_set_state_save_interval(zsimpledisco_t *self, int msecs)
+{
+	s_set_interval (self, "state save", msecs);
+}
+void
+zsimpledisco_set_reconnect_interval(zsimpledisco_t *self, int msecs)
+{
+	s_set_interval (self, "reconnect", msecs);
+}
+void
+zsimpledisco_set_peer_timeout(zsimpledisco_t *self, int msecs)
+{
+	s_set_interval (self, "peer timeout", msecs);
+}
+void
 zsimpledisco_get_values(zsimpledisco_t *self)
 {
 	zstr_sendx (self->actor, "GET VALUES", NULL);
 }
+char *
+zsimpledisco_stats(zsimpledisco_t *self)
+{
+	zstr_sendx (self->actor, "STATS", NULL);
+	return zstr_recv (self->actor);
+}
+
+//  Answers every HTTP request with the stats, whatever it asked for
+void
+zsimpledisco_serve_stats(zsimpledisco_t *self, zsock_t *stream, const char *extra)
+{
+    zframe_t *routing_id = zframe_recv (stream);
+    zframe_t *request = zframe_recv (stream);
+    //  An empty frame only tells of a connection opening or closing
+    if(routing_id && request && zframe_size(request) > 0) {
+        char *stats = zsimpledisco_stats(self);
+        char *response = zsys_sprintf("HTTP/1.0 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: %zu\r\n\r\n%s%s",
+            strlen(stats ? stats : "") + strlen(extra ? extra : ""),
+            stats ? stats : "", extra ? extra : "");
+        zframe_send (&routing_id, stream, ZFRAME_MORE + ZFRAME_REUSE);
+        zstr_send (stream, response);
+        //  An empty frame closes the connection
+        zframe_t *closing = zframe_new_empty ();
+        zframe_send (&routing_id, stream, ZFRAME_MORE);
+        zframe_send (&closing, stream, 0);
+        zstr_free (&stats);
+        zstr_free (&response);
+    }
+    zframe_destroy (&routing_id);
+    zframe_destroy (&request);
+}
 
 
 //  --------------------------------------------------------------------------
@@ -133,28 +467,66 @@ zsimpledisco_socket (zsimpledisco_t *self)
 //Helpers
 
 int
-zsimpledisco_dump_hash(zhash_t *h)
+zsimpledisco_dump_hash(zregistry_t *h)
 {
     value_t *val;
     int64_t now = zclock_mono();
-    for (val = zhash_first (h); val != NULL; val = zhash_next (h)) {
-        const char *key = zhash_cursor (h);
+    for (val = zregistry_first (h); val != NULL; val = zregistry_next (h)) {
+        const char *key = zregistry_cursor (h);
         zsys_info("zsimpledisco: key='%s' value='%s' ts='%ld' age='%ld'", key, val->value, val->ts, (now-val->ts) / 1000);
     }
     return 0;
 }
-zhash_t *
-convert_hash(zhash_t *h)
+
+//  Packs server records as their plain values
+static const char *
+s_record_value(void *item)
 {
-    zhash_t *kv = zhash_new();
-    zhash_autofree(kv);
-    value_t *val;
-    for (val = zhash_first (h); val != NULL; val = zhash_next (h)) {
-        const char *key = zhash_cursor (h);
-        //zsys_debug("zsimpledisco: Creating new hash with just %s=%s", key, val->value);
-        zhash_update(kv, key, val->value);
+    return ((value_t *) item)->value;
+}
+
+//  Server records and their strings come from slabs owned by the actor, so
+//  records that come and go at a steady rate reuse memory instead of malloc.
+static zslab_t *
+s_self_string_slab(self_t *self, size_t size)
+{
+    int string_class;
+    for (string_class = 0; string_class < STRING_CLASSES; string_class++)
+        if(size <= ((size_t) 32 << string_class))
+            return self->string_slabs[string_class];
+    return NULL;
+}
+
+static char *
+s_self_strdup(self_t *self, const char *string)
+{
+    size_t size = strlen(string) + 1;
+    zslab_t *slab = s_self_string_slab(self, size);
+    char *copy = slab ? (char *) zslab_alloc(slab) : (char *) malloc(size);
+    assert(copy);
+    memcpy(copy, string, size);
+    return copy;
+}
+
+static void
+s_self_strfree(self_t *self, char **string_p)
+{
+    if(*string_p) {
+        zslab_t *slab = s_self_string_slab(self, strlen(*string_p) + 1);
+        if(slab)
+            zslab_free(slab, *string_p);
+        else
+            free(*string_p);
+        *string_p = NULL;
     }
-    return kv;
+}
+
+static void
+s_self_record_free(self_t *self, value_t *record)
+{
+    s_self_strfree(self, &record->key);
+    s_self_strfree(self, &record->value);
+    zslab_free(self->record_slab, record);
 }
 
 static void
@@ -163,17 +535,50 @@ s_self_destroy (self_t **self_p)
     assert (self_p);
     if (*self_p) {
         self_t *self = *self_p;
+        zpoller_destroy (&self->poller);
         if (self->server_socket) // don't close STDIN
             zsock_destroy (&self->server_socket);
         zsock_destroy (&self->outbox);
-        zhash_destroy(&self->data);
-        zhash_destroy(&self->client_data);
-        zhash_destroy(&self->client_sockets); //disconnect first?
-        zlist_destroy(&self->reconnect_queue);
+        zregistry_destroy(&self->data);
+        zregistry_destroy(&self->tombstones);
+        zexpiry_destroy(&self->expiry);
+        zregistry_destroy(&self->leases);
+        zexpiry_destroy(&self->lease_expiry);
+        deadline_t *timer;
+        while ((timer = (deadline_t *) zexpiry_pop_expired (self->timers, INT64_MAX)))
+            if(timer->oneshot)
+                free(timer);
+        zexpiry_destroy(&self->timers);
+        free(self->deliver_timer);
+        free(self->send_timer);
+        free(self->cleanup_timer);
+        free(self->state_timer);
+        free(self->sync_timer);
+        free(self->allowlist_timer);
+        value_t *record;
+        for (record = zlistx_first (self->changes); record != NULL; record = zlistx_next (self->changes))
+            s_self_record_free(self, record);
+        zlistx_destroy(&self->changes);
+        zslab_destroy(&self->record_slab);
+        int string_class;
+        for (string_class = 0; string_class < STRING_CLASSES; string_class++)
+            zslab_destroy(&self->string_slabs[string_class]);
+        zframe_destroy(&self->snapshot);
+        zstr_free(&self->epoch);
+        zstr_free(&self->state_path);
+        zstr_free(&self->state_log_path);
+        zregistry_destroy(&self->replicas);
+        zregistry_destroy(&self->client_data);
+        zregistry_destroy(&self->client_ttls);
+        zregistry_destroy(&self->client_peers); //disconnect first?
+        zregistry_destroy(&self->delivered);
+        zregistry_destroy(&self->watchers);
+        zstr_free(&self->watch_prefix);
         if(self->auth)
             zactor_destroy (&self->auth);
-        if(self->certstore)
-            zcertstore_destroy(&self->certstore);
+        zregistry_destroy(&self->allowlist);
+        zstr_free(&self->certstore_path);
+        zdirwatch_destroy(&self->certstore_watch);
         if(self->private_key)
             zcert_destroy(&self->private_key);
         freen (self);
@@ -195,12 +600,35 @@ s_self_new (zsock_t *pipe)
     self->send_interval = self->cleanup_max_age - 2 * self->cleanup_interval;
     self->reconnect_interval = 90 * 1000;
     self->peer_timeout = 2 * 1000;
-
-    self->data = zhash_new();
-    self->client_data = zhash_new();
-    self->client_sockets = zhash_new();
-    self->reconnect_queue = zlist_new();
-    zlist_autofree(self->reconnect_queue);
+    self->tombstone_max_age = 5 * 60 * 1000;
+    self->state_save_interval = 10 * 1000;
+    self->sync_slot = 10 * 1000;
+    self->sync_interval = 5 * 1000;
+
+    self->data = zregistry_new();
+    self->tombstones = zregistry_new();
+    self->expiry = zexpiry_new();
+    self->leases = zregistry_new();
+    zregistry_set_destructor(self->leases, lease_t_free);
+    self->lease_expiry = zexpiry_new();
+    self->changes = zlistx_new();
+    self->record_slab = zslab_new(sizeof (value_t));
+    int string_class;
+    for (string_class = 0; string_class < STRING_CLASSES; string_class++)
+        self->string_slabs[string_class] = zslab_new((size_t) 32 << string_class);
+    self->epoch = zsys_sprintf("%" PRId64 "-%d", zclock_time(), getpid());
+    self->client_data = zregistry_new();
+    zregistry_autofree(self->client_data);
+    self->client_ttls = zregistry_new();
+    zregistry_autofree(self->client_ttls);
+    self->client_peers = zregistry_new();
+    zregistry_set_destructor(self->client_peers, peer_t_free);
+    self->delivered = zregistry_new();
+    zregistry_autofree(self->delivered);
+    self->replicas = zregistry_new();
+    zregistry_set_destructor(self->replicas, peer_t_free);
+    self->watchers = zregistry_new();
+    zregistry_set_destructor(self->watchers, watcher_t_free);
 
     return self;
 }
@@ -212,31 +640,16 @@ static void
 s_self_refresh_data(self_t *self)
 {
     // Send new values immediately
-    self->last_send = 0;
+    s_self_timer_at(self, self->send_timer, zclock_mono());
 
     // Deliver 2 seconds later
-    self->last_deliver = zclock_mono() - self->deliver_interval + 2000 ;
-}
-
-// Callback for removing items from the client_sockets hash
-static void
-s_zsocket_free(void *argument)
-{
-    zsock_t *socket = (zsock_t *) argument;
-    zsock_destroy(&socket);
+    s_self_timer_at(self, self->deliver_timer, zclock_mono() + 2000);
 }
 
-static int
-s_self_connect(self_t *self, const char *endpoint)
+//  Open a DEALER socket to a server, endpoint may end in |public_key
+static zsock_t *
+s_self_peer_socket(self_t *self, const char *endpoint)
 {
-    // Ignore if we already have a connection for this endpoint
-    // Unifying inital connections and reconnections will make this not needed.
-    void *val = zhash_lookup(self->client_sockets, endpoint);
-    if (val)
-        return 0;
-    if (self->verbose)
-        zsys_debug("zsimpledisco: Client wants to connect to %s", endpoint);
-
     char *public_key = NULL;
     char *endpoint_copy = strdup(endpoint);
     char *pipe = strchr(endpoint_copy, '|');
@@ -257,19 +670,59 @@ s_self_connect(self_t *self, const char *endpoint)
 
     if(-1 == zsock_connect(sock, "%s", endpoint_copy)) {
         zsys_error("Invalid endpoint %s", endpoint_copy);
-        return -1;
+        zsock_destroy(&sock);
+        free(endpoint_copy);
+        return NULL;
     }
-
-    zhash_update (self->client_sockets, endpoint, sock);
-    zhash_freefn (self->client_sockets, endpoint, s_zsocket_free);
+    if(self->poller)
+        zpoller_add(self->poller, sock);
     free(endpoint_copy);
+    return sock;
+}
+
+static peer_t *
+s_self_new_peer(self_t *self, const char *endpoint)
+{
+    zsock_t *sock = s_self_peer_socket(self, endpoint);
+    if(!sock)
+        return NULL;
+    peer_t *peer = (peer_t *) zmalloc (sizeof (peer_t));
+    peer->endpoint = strdup(endpoint);
+    peer->sock = sock;
+    peer->values = zregistry_new();
+    zregistry_autofree(peer->values);
+    return peer;
+}
+
+static void
+s_self_close_peer_socket(self_t *self, peer_t *peer)
+{
+    if(peer->sock && self->poller)
+        zpoller_remove(self->poller, peer->sock);
+    zsock_destroy(&peer->sock);
+}
+
+static int
+s_self_connect(self_t *self, const char *endpoint)
+{
+    // Ignore if we already have a connection for this endpoint
+    void *val = zregistry_lookup(self->client_peers, endpoint);
+    if (val)
+        return 0;
+    if (self->verbose)
+        zsys_debug("zsimpledisco: Client wants to connect to %s", endpoint);
+
+    peer_t *peer = s_self_new_peer(self, endpoint);
+    if(!peer)
+        return -1;
+    zregistry_update (self->client_peers, endpoint, peer);
     return 0;
 }
 
 static int
 s_self_connect_initial(self_t *self, const char *endpoint)
 {
-    void *val = zhash_lookup(self->client_sockets, endpoint);
+    void *val = zregistry_lookup(self->client_peers, endpoint);
     if(val)
         return 0;
     int ret =  s_self_connect(self, endpoint);
@@ -278,225 +731,1208 @@ s_self_connect_initial(self_t *self, const char *endpoint)
     return ret;
 }
 
-static int
-s_self_client_reconnect_all(self_t *self)
+static void
+s_self_disconnect(self_t *self, const char *endpoint)
 {
-    const char *endpoint = (const char *) zlist_first (self->reconnect_queue);
-    while (endpoint) {
-        if (self->verbose)
-            zsys_debug ("zsimpledisco: reconnecting to %s!", endpoint);
-        s_self_connect(self, endpoint);
-        endpoint = (const char *) zlist_next (self->reconnect_queue);
-    }
-    zlist_purge(self->reconnect_queue);
-    return 0;
+    peer_t *peer = (peer_t *) zregistry_lookup(self->client_peers, endpoint);
+    if(!peer)
+        return;
+    if (self->verbose)
+        zsys_debug("zsimpledisco: Client disconnecting from %s", endpoint);
+    s_self_close_peer_socket(self, peer);
+    zregistry_delete(self->client_peers, endpoint);
+    //  Deliver soon so its keys are dropped from the merged view
+    s_self_timer_at(self, self->deliver_timer, zclock_mono());
 }
 
-static int
-s_self_client_reconnect_later(self_t *self, const char *endpoint)
+static void
+s_self_client_check_health(self_t *self);
+
+//  Stop using a server that failed a request. Its socket is dropped, with
+//  any late replies, and it is probed again after a backoff that doubles
+//  with every failure up to reconnect_interval. The jitter keeps clients
+//  from coming back in lockstep after an outage. Our copy of its values
+//  stays, so readmission only needs a delta.
+static void
+s_self_peer_failed(self_t *self, peer_t *peer)
 {
+    s_self_close_peer_socket(self, peer);
+    if(!peer->failures)
+        peer->failed_since = zclock_mono();
+    peer->failures++;
+    peer->probe_sent = 0;
+    int64_t backoff = self->reconnect_interval;
+    if(peer->failures < 20 && (1000 << (peer->failures - 1)) < backoff)
+        backoff = 1000 << (peer->failures - 1);
+    backoff = backoff / 2 + randof(backoff / 2 + 1);
+    peer->retry_at = zclock_mono() + backoff;
+    s_self_once(self, peer->retry_at, s_self_client_check_health);
     if (self->verbose)
-        zsys_debug ("zsimpledisco: reconnect to %s later", endpoint);
-    int ret = zlist_append(self->reconnect_queue, (void *)endpoint);
-    zhash_delete (self->client_sockets, endpoint);
-    return ret;
+        zsys_debug ("zsimpledisco: %s failed %d times, probing again in %" PRId64 " ms", peer->endpoint, peer->failures, backoff);
 }
 
-static int
-s_self_client_publish(self_t *self, char *key, char *value)
+//  Send a PING to each unhealthy server whose backoff is over, and fail
+//  the probes that weren't answered in time. Never waits for a reply, runs
+//  from the one-shot timers set when a server fails or is probed.
+static void
+s_self_client_check_health(self_t *self)
 {
-    zsock_t *sock;
-    for (sock = zhash_first (self->client_sockets); sock != NULL; sock = zhash_next (self->client_sockets)) {
-        const char *endpoint = zhash_cursor (self->client_sockets);
-        if (self->verbose)
-            zsys_debug("zsimpledisco: PUBLISH %s => '%s' '%s'", endpoint, key, value);
-        if(-1 == zstr_sendx(sock, "PUBLISH", key, value, NULL)) {
-            if (self->verbose)
-                zsys_info("zsimpledisco: send to %s failed", endpoint);
+    int64_t now = zclock_mono();
+    peer_t *peer;
+    for (peer = zregistry_first (self->client_peers); peer != NULL; peer = zregistry_next (self->client_peers)) {
+        if(!peer->failures)
+            continue;
+        if(peer->probe_sent && now - peer->probe_sent > self->peer_timeout) {
+            peer->timeouts++;
+            s_self_peer_failed(self, peer);
         }
-        //TODO: this should do scatter/gather kind of thing
-        char *response = zstr_recv(sock);
-        if(response) {
-            zstr_free(&response);
-        } else {
-            if (self->verbose)
-                zsys_info("zsimpledisco: no response from %s", endpoint);
-            s_self_client_reconnect_later(self, endpoint);
+        if(peer->probe_sent || now < peer->retry_at)
+            continue;
+        peer->sock = s_self_peer_socket(self, peer->endpoint);
+        if(!peer->sock || -1 == zstr_send(peer->sock, "PING")) {
+            s_self_peer_failed(self, peer);
+            continue;
         }
+        self->stats.reconnects++;
+        peer->probe_sent = now;
+        s_self_once(self, now + self->peer_timeout + 1, s_self_client_check_health);
     }
-    return 0;
 }
 
-static int
-s_self_client_publish_all(self_t *self)
+//  A server answered our probe, use it again right away
+static void
+s_self_peer_readmit(self_t *self, peer_t *peer)
 {
-    zsock_t *sock;
-    char * value;
-    for (sock = zhash_first (self->client_sockets); sock != NULL; sock = zhash_next (self->client_sockets)) {
-        const char *endpoint = zhash_cursor (self->client_sockets);
-        for (value = zhash_first (self->client_data); value != NULL; value = zhash_next (self->client_data)) {
-            const char *key = zhash_cursor (self->client_data);
-            if (self->verbose)
-                zsys_debug("zsimpledisco: PUBLISH %s => '%s' '%s'", endpoint, key, value);
-            if(-1 == zstr_sendx(sock, "PUBLISH", key, value, NULL)) {
-                if (self->verbose)
-                    zsys_info("zsimpledisco: send to %s failed", endpoint);
-            }
-            //TODO: this should do scatter/gather kind of thing
-            char *response = zstr_recv(sock);
-            if(response) {
-                zstr_free(&response);
-            } else {
-                if (self->verbose)
-                    zsys_info("zsimpledisco: no response from %s", endpoint);
-                s_self_client_reconnect_later(self, endpoint);
-                break;
-            }
-        }
-    }
-    return 0;
+    if (self->verbose)
+        zsys_info ("zsimpledisco: %s is back after %d failures", peer->endpoint, peer->failures);
+    peer->failures = 0;
+    peer->probe_sent = 0;
+    s_self_refresh_data(self);
+}
 
+//  Our copy of a server's values stays in the merged view while the server
+//  is in backoff, so one timeout doesn't report all its keys REMOVED and
+//  then ADDED again. Once it has failed for longer than servers keep a
+//  record without a refresh, the copy can only be stale.
+static bool
+s_self_peer_values_current(self_t *self, peer_t *peer)
+{
+    return !peer->failures || zclock_mono() - peer->failed_since < self->cleanup_max_age;
 }
 
+//  Tell the application about a key if it differs from what it was told
+//  last. A NULL value means no server has the key anymore.
 static void
-zsimpledisco_merge_hash(zhash_t *dest, zhash_t *src)
+s_self_deliver_value(self_t *self, const char *key, const char *value)
 {
-    void *val;
-    for (val = zhash_first (src); val != NULL; val = zhash_next (src)) {
-        const char *key = zhash_cursor (src);
-        //zsys_debug("zsimpledisco: Adding %s to new merged hash", key);
-        zhash_update (dest, key, val);
+    const char *old_value = (const char *) zregistry_lookup (self->delivered, key);
+    if(value && !old_value) {
+        zstr_sendx(self->outbox, "ADDED", key, value, NULL);
+        zregistry_insert(self->delivered, key, (void *) value);
+    }
+    else
+    if(value && strneq(value, old_value)) {
+        zstr_sendx(self->outbox, "CHANGED", key, value, NULL);
+        zregistry_update(self->delivered, key, (void *) value);
+    }
+    else
+    if(!value && old_value) {
+        zstr_sendx(self->outbox, "REMOVED", key, old_value, NULL);
+        zregistry_delete(self->delivered, key);
     }
 }
 
-static int
-s_self_client_get_values(self_t *self, zhash_t *merged)
+//  Deliver the merged value of one key, as of our copies of the servers' values
+static void
+s_self_deliver_key(self_t *self, const char *key)
 {
-    zsock_t *sock;
-    for (sock = zhash_first (self->client_sockets); sock != NULL; sock = zhash_next (self->client_sockets)) {
-        const char *endpoint = zhash_cursor (self->client_sockets);
-        if (self->verbose)
-            zsys_debug("zsimpledisco: Send %s => 'VALUES'", endpoint);
-        if(-1 == zstr_send(sock, "VALUES")) {
-            if (self->verbose)
-                zsys_info("zsimpledisco: send to %s failed", endpoint);
-        }
-        //TODO: this should do scatter/gather kind of thing
-        zframe_t *data = zframe_recv(sock);
-        if(data) {
-            zhash_t *h = zhash_unpack(data);
-            zsimpledisco_merge_hash(merged, h);
-            zhash_destroy(&h);
-            zframe_destroy(&data);
-        } else {
-            if (self->verbose)
-                zsys_info("zsimpledisco: no response from %s", endpoint);
-            s_self_client_reconnect_later(self, endpoint);
-        }
+    const char *value = NULL;
+    peer_t *peer;
+    for (peer = zregistry_first (self->client_peers); peer != NULL; peer = zregistry_next (self->client_peers)) {
+        if(!s_self_peer_values_current(self, peer))
+            continue;
+        const char *peer_value = (const char *) zregistry_lookup (peer->values, key);
+        if(peer_value)
+            value = peer_value;
     }
-    return 0;
+    s_self_deliver_value(self, key, value);
 }
 
-
-// Server Stuff
-
-int
-s_self_set_certstore_path(self_t *self, const char *path)
+//  Apply a change pushed by a server we are watching. Returns false when
+//  msg is not an EVENT, so the caller can treat it as a reply instead.
+//  Events only update our copy of the server's values, not its generation:
+//  with a prefix we don't see every change, the next delta catches us up.
+static bool
+s_self_client_event(self_t *self, peer_t *peer, zmsg_t *msg)
 {
-    if(self->verbose)
-        zsys_info("zsimpledisco: Certificate directory: %s", path);
-    if(self->auth == NULL) {
-        //Start authenticator
-        zactor_t *auth = zactor_new (zauth,NULL);
-        self->auth = auth;
-        if (self->verbose) {
-            zstr_send(auth,"VERBOSE");
-            zsock_wait(auth);
-        }
+    zframe_t *first = zmsg_first(msg);
+    if(!first || !zframe_streq(first, "EVENT"))
+        return false;
+
+    first = zmsg_pop(msg);
+    zframe_destroy(&first);
+    char *epoch = zmsg_popstr(msg);
+    char *generation = zmsg_popstr(msg);
+    char *kind = zmsg_popstr(msg);
+    char *key = zmsg_popstr(msg);
+    char *value = zmsg_popstr(msg);
+    if(!kind || !key) {
+        zsys_error("zsimpledisco: invalid EVENT from %s", peer->endpoint);
     }
-    //  Tell the authenticator to use the certificate store in ./certs
-    zstr_sendx (self->auth, "CURVE", path, NULL);
-
-    if(self->certstore) {
-        zcertstore_destroy(&self->certstore);
+    else
+    if(!peer->epoch || !epoch || strneq(epoch, peer->epoch)) {
+        //  We don't have a base from this server run yet, wait for VALUES
     }
-    self->certstore = zcertstore_new(path);
-    return 0;
+    else
+    if(streq(kind, "SET") && value) {
+        if (self->verbose)
+            zsys_debug("zsimpledisco: EVENT %s SET '%s' '%s' at %s", peer->endpoint, key, value, generation);
+        zregistry_update(peer->values, key, value);
+        s_self_deliver_key(self, key);
+    }
+    else
+    if(streq(kind, "EXPIRE")) {
+        if (self->verbose)
+            zsys_debug("zsimpledisco: EVENT %s EXPIRE '%s' at %s", peer->endpoint, key, generation);
+        zregistry_delete(peer->values, key);
+        s_self_deliver_key(self, key);
+    }
+    zstr_free(&epoch);
+    zstr_free(&generation);
+    zstr_free(&kind);
+    zstr_free(&key);
+    zstr_free(&value);
+    return true;
 }
 
-int
-s_self_set_private_key_path(self_t *self, const char *path)
+static peer_t *
+s_find_peer(zregistry_t *peers, zsock_t *sock)
 {
-    if(self->verbose)
-        zsys_info("zsimpledisco: Using private key: %s", path);
+    peer_t *peer;
+    for (peer = zregistry_first (peers); peer != NULL; peer = zregistry_next (peers))
+        if (peer->sock == sock)
+            break;
+    return peer;
+}
 
-    self->private_key = zcert_load(path);
-    if(!self->private_key) {
-        zsys_error("zsimpledisco: unable to load private key from %s", path);
-        return 1;
+static void
+s_self_handle_replica_reply(self_t *self, peer_t *replica, zmsg_t *msg);
+
+//  Handle traffic on a client socket outside of a request, which should
+//  only be pushed events. Anything else is a reply that arrived too late.
+//  Replica sockets only ever carry replies to SYNC.
+static int
+s_self_handle_peer_socket(self_t *self, zsock_t *sock)
+{
+    zmsg_t *msg = zmsg_recv (sock);
+    peer_t *replica = s_find_peer(self->replicas, sock);
+    if(msg && replica) {
+        s_self_handle_replica_reply(self, replica, msg);
+        zmsg_destroy(&msg);
+        return 0;
+    }
+    peer_t *peer = s_find_peer(self->client_peers, sock);
+    if(msg && peer && peer->probe_sent) {
+        if(zframe_streq(zmsg_first(msg), "PONG"))
+            s_self_peer_readmit(self, peer);
+    }
+    else
+    if(msg && peer && !s_self_client_event(self, peer, msg)) {
+        if (self->verbose)
+            zsys_debug("zsimpledisco: dropping late reply from %s", peer->endpoint);
     }
+    zmsg_destroy(&msg);
     return 0;
 }
 
-int
-s_self_bind(self_t *self, const char *endpoint)
+//  Send a request to every connected server at once, then collect the
+//  replies as they arrive. The whole exchange is bounded by peer_timeout,
+//  servers that fail to send or answer in time are probed again later.
+//  Unhealthy servers are skipped, they cost nothing until readmitted.
+static void
+s_self_client_scatter_gather(self_t *self, s_request_fn *request, s_reply_fn *handler, void *arg)
 {
-    if(self->verbose)
-        zsys_info("zsimpledisco: binding to %s", endpoint);
-
-    if(self->private_key) {
-        zcert_apply (self->private_key, self->server_socket);
-        zsock_set_curve_server (self->server_socket, 1);
-        assert (zsock_mechanism (self->server_socket) == ZMQ_CURVE);
+    zpoller_t *poller = zpoller_new (NULL);
+    zlist_t *waiting = zlist_new ();
+    zlist_t *failed = zlist_new ();
+
+    peer_t *peer;
+    for (peer = zregistry_first (self->client_peers); peer != NULL; peer = zregistry_next (self->client_peers)) {
+        if(peer->failures)
+            continue;
+        peer->pending = request(self, peer, arg);
+        if (peer->pending < 0) {
+            if (self->verbose)
+                zsys_info("zsimpledisco: send to %s failed", peer->endpoint);
+            zlist_append(failed, peer);
+        }
+        else
+        if (peer->pending > 0) {
+            zpoller_add(poller, peer->sock);
+            zlist_append(waiting, peer);
+        }
+    }
+
+    int64_t deadline = zclock_mono() + self->peer_timeout;
+    while (zlist_size (waiting)) {
+        int64_t remaining = deadline - zclock_mono();
+        if (remaining <= 0)
+            break;
+        zsock_t *which = (zsock_t *) zpoller_wait (poller, (int) remaining);
+        if (!which) {
+            if (zpoller_terminated (poller))
+                break;
+            continue;
+        }
+        for (peer = zlist_first (waiting); peer != NULL; peer = zlist_next (waiting))
+            if (peer->sock == which)
+                break;
+        assert (peer);
+        zmsg_t *reply = zmsg_recv (which);
+        if (!reply)
+            continue;
+        if (s_self_client_event(self, peer, reply)) {
+            zmsg_destroy (&reply);
+            continue;
+        }
+        if (handler)
+            handler(self, peer, reply, arg);
+        zmsg_destroy (&reply);
+        if (--peer->pending == 0) {
+            zpoller_remove(poller, which);
+            zlist_remove(waiting, peer);
+        }
+    }
+
+    for (peer = zlist_first (waiting); peer != NULL; peer = zlist_next (waiting)) {
+        if (self->verbose)
+            zsys_info("zsimpledisco: no response from %s", peer->endpoint);
+        peer->timeouts++;
+        zlist_append(failed, peer);
+    }
+    zpoller_destroy (&poller);
+    zlist_destroy (&waiting);
+
+    for (peer = zlist_first (failed); peer != NULL; peer = zlist_next (failed))
+        s_self_peer_failed(self, peer);
+    zlist_destroy (&failed);
+}
+
+typedef struct {
+    const char *key;
+    const char *value;
+    const char *ttl;            //  NULL for the server's default
+} kv_t;
+
+static int
+s_publish_request(self_t *self, peer_t *peer, void *arg)
+{
+    kv_t *kv = (kv_t *) arg;
+    if (self->verbose)
+        zsys_debug("zsimpledisco: PUBLISH %s => '%s' '%s'", peer->endpoint, kv->key, kv->value);
+    if(-1 == zstr_sendx(peer->sock, "PUBLISH", kv->key, kv->value, kv->ttl, NULL))
+        return -1;
+    return 1;
+}
+
+static int
+s_self_client_publish(self_t *self, char *key, char *value)
+{
+    kv_t kv = { key, value, (const char *) zregistry_lookup (self->client_ttls, key) };
+    s_self_client_scatter_gather(self, s_publish_request, NULL, &kv);
+    return 0;
+}
+
+//  All of our keys go out in a single PUBLISH-BATCH with a single OK back,
+//  or PUBLISH-BATCH-TTL with a TTL after every key/value if any has one.
+//  Once the server has given them a lease, and as long as our keys stay
+//  the same, a RENEW of the lease keeps them all alive instead.
+static int
+s_publish_all_request(self_t *self, peer_t *peer, void *arg)
+{
+    (void) arg;
+    if(zregistry_size (self->client_data) == 0)
+        return 0;
+    if(peer->lease && peer->lease_version == self->client_data_version) {
+        if (self->verbose)
+            zsys_debug("zsimpledisco: RENEW %s => '%s'", peer->endpoint, peer->lease);
+        if(-1 == zstr_sendx(peer->sock, "RENEW", peer->lease, NULL))
+            return -1;
+        return 1;
+    }
+    bool with_ttls = zregistry_size (self->client_ttls) > 0;
+    zmsg_t *msg = zmsg_new();
+    zmsg_addstr(msg, with_ttls ? "PUBLISH-BATCH-TTL" : "PUBLISH-BATCH");
+    char * value;
+    for (value = zregistry_first (self->client_data); value != NULL; value = zregistry_next (self->client_data)) {
+        const char *key = zregistry_cursor (self->client_data);
+        if (self->verbose)
+            zsys_debug("zsimpledisco: PUBLISH-BATCH %s => '%s' '%s'", peer->endpoint, key, value);
+        zmsg_addstr(msg, key);
+        zmsg_addstr(msg, value);
+        if(with_ttls) {
+            const char *ttl = (const char *) zregistry_lookup (self->client_ttls, key);
+            zmsg_addstr(msg, ttl ? ttl : "0");
+        }
+    }
+    if(-1 == zmsg_send(&msg, peer->sock)) {
+        zmsg_destroy(&msg);
+        return -1;
+    }
+    return 1;
+}
+
+//  OK with a lease id after PUBLISH-BATCH, OK or UNKNOWN after RENEW
+static void
+s_publish_all_reply(self_t *self, peer_t *peer, zmsg_t *reply, void *arg)
+{
+    (void) arg;
+    char *status = zmsg_popstr(reply);
+    char *lease = zmsg_popstr(reply);
+    if(status && streq(status, "OK") && lease) {
+        zstr_free(&peer->lease);
+        peer->lease = lease;
+        lease = NULL;
+        peer->lease_version = self->client_data_version;
+    }
+    else
+    if(status && streq(status, "UNKNOWN")) {
+        //  The lease lapsed or the server restarted, register again right
+        //  away; the scatter-gather waits for this reply too
+        if (self->verbose)
+            zsys_info("zsimpledisco: %s forgot lease '%s'", peer->endpoint, peer->lease);
+        zstr_free(&peer->lease);
+        int sent = s_publish_all_request(self, peer, NULL);
+        if(sent > 0)
+            peer->pending += sent;
+        else
+        if(sent < 0)
+            s_self_timer_at(self, self->send_timer, zclock_mono());
+    }
+    zstr_free(&status);
+    zstr_free(&lease);
+}
+
+static int
+s_self_client_publish_all(self_t *self)
+{
+    s_self_client_scatter_gather(self, s_publish_all_request, s_publish_all_reply, NULL);
+    return 0;
+
+}
+
+static void
+zsimpledisco_merge_hash(zregistry_t *dest, zregistry_t *src)
+{
+    void *val;
+    for (val = zregistry_first (src); val != NULL; val = zregistry_next (src)) {
+        const char *key = zregistry_cursor (src);
+        //zsys_debug("zsimpledisco: Adding %s to new merged hash", key);
+        zregistry_update (dest, key, val);
+    }
+}
+
+static int
+s_values_request(self_t *self, peer_t *peer, void *arg)
+{
+    (void) arg;
+    //  Watches lapse on the server unless renewed, VALUES is our heartbeat for them
+    if(self->watch_prefix && -1 == zstr_sendx(peer->sock, "WATCH", self->watch_prefix, NULL))
+        return -1;
+    char *since = zsys_sprintf("%" PRIu64, peer->generation);
+    if (self->verbose)
+        zsys_debug("zsimpledisco: Send %s => 'VALUES SINCE' '%s' '%s'", peer->endpoint,
+            peer->epoch ? peer->epoch : "", since);
+    int rc = zstr_sendx(peer->sock, "VALUES SINCE", peer->epoch ? peer->epoch : "", since, NULL);
+    zstr_free(&since);
+    return rc == -1 ? -1 : 1;
+}
+
+//  Apply a VALUES SINCE reply to our copy of that server's values
+static void
+s_values_reply(self_t *self, peer_t *peer, zmsg_t *reply, void *arg)
+{
+    (void) arg;
+    char *epoch = zmsg_popstr(reply);
+    char *generation = zmsg_popstr(reply);
+    char *kind = zmsg_popstr(reply);
+    zframe_t *set_frame = zmsg_pop(reply);
+    zframe_t *removed_frame = zmsg_pop(reply);
+    zregistry_t *set = set_frame ? zregistry_unpack(set_frame) : NULL;
+    zregistry_t *removed = removed_frame ? zregistry_unpack(removed_frame) : NULL;
+    if(!epoch || !generation || !kind || !set || !removed) {
+        zsys_error("zsimpledisco: invalid VALUES reply from %s", peer->endpoint);
+        goto out;
+    }
+    if (self->verbose)
+        zsys_debug("zsimpledisco: %s VALUES from %s at %s: %zu set, %zu removed", kind, peer->endpoint,
+            generation, zregistry_size(set), zregistry_size(removed));
+
+    if(streq(kind, "FULL")) {
+        zregistry_destroy(&peer->values);
+        peer->values = set;
+        set = NULL;
+    } else {
+        char *value;
+        for (value = zregistry_first (set); value != NULL; value = zregistry_next (set))
+            zregistry_update(peer->values, zregistry_cursor (set), value);
+        for (value = zregistry_first (removed); value != NULL; value = zregistry_next (removed))
+            zregistry_delete(peer->values, zregistry_cursor (removed));
+    }
+    zstr_free(&peer->epoch);
+    peer->epoch = epoch;
+    epoch = NULL;
+    peer->generation = strtoull(generation, NULL, 10);
+
+out:
+    zregistry_destroy(&set);
+    zregistry_destroy(&removed);
+    zframe_destroy(&set_frame);
+    zframe_destroy(&removed_frame);
+    zstr_free(&epoch);
+    zstr_free(&generation);
+    zstr_free(&kind);
+}
+
+static int
+s_self_client_get_values(self_t *self, zregistry_t *merged)
+{
+    s_self_client_scatter_gather(self, s_values_request, s_values_reply, NULL);
+    peer_t *peer;
+    for (peer = zregistry_first (self->client_peers); peer != NULL; peer = zregistry_next (self->client_peers))
+        if(s_self_peer_values_current(self, peer))
+            zsimpledisco_merge_hash(merged, peer->values);
+    return 0;
+}
+
+
+// Server Stuff
+
+//  Read the public keys from certstore_path into a fresh allowlist. The
+//  certstore is only used for loading, a lookup in it can hit the disk.
+static void
+s_self_load_allowlist(self_t *self)
+{
+    zcertstore_t *certstore = zcertstore_new(self->certstore_path);
+    zregistry_t *allowlist = zregistry_new();
+    zregistry_autofree(allowlist);
+    zlistx_t *certs = zcertstore_certs(certstore);
+    zcert_t *cert;
+    for (cert = (zcert_t *) zlistx_first(certs); cert != NULL; cert = (zcert_t *) zlistx_next(certs))
+        zregistry_update(allowlist, zcert_public_txt(cert), (void *) zcert_public_txt(cert));
+    zlistx_destroy(&certs);
+    zcertstore_destroy(&certstore);
+
+    if (self->verbose)
+        zsys_info("zsimpledisco: Allowing %zu public keys from %s", zregistry_size(allowlist), self->certstore_path);
+    zregistry_destroy(&self->allowlist);
+    self->allowlist = allowlist;
+}
+
+int
+s_self_set_certstore_path(self_t *self, const char *path)
+{
+    if(self->verbose)
+        zsys_info("zsimpledisco: Certificate directory: %s", path);
+    if(self->auth == NULL) {
+        //Start authenticator
+        zactor_t *auth = zactor_new (zauth,NULL);
+        self->auth = auth;
+        if (self->verbose) {
+            zstr_send(auth,"VERBOSE");
+            zsock_wait(auth);
+        }
+    }
+    //  Tell the authenticator to use the certificate store in ./certs
+    zstr_sendx (self->auth, "CURVE", path, NULL);
+
+    zstr_free(&self->certstore_path);
+    self->certstore_path = strdup(path);
+    zdirwatch_destroy(&self->certstore_watch);
+    self->certstore_watch = zdirwatch_new(path);
+    s_self_load_allowlist(self);
+    s_self_timer_at(self, self->allowlist_timer, zclock_mono() + 1000);
+    return 0;
+}
+
+//  Reload the allowlist when the certificate directory changed. Runs every
+//  second, so a revoked key stops working within a second.
+static void
+s_self_check_allowlist(self_t *self)
+{
+    if(!self->certstore_watch)
+        return;
+    if(zdirwatch_changed(self->certstore_watch))
+        s_self_load_allowlist(self);
+    s_self_timer_at(self, self->allowlist_timer, zclock_mono() + 1000);
+}
+
+int
+s_self_set_private_key_path(self_t *self, const char *path)
+{
+    if(self->verbose)
+        zsys_info("zsimpledisco: Using private key: %s", path);
+
+    self->private_key = zcert_load(path);
+    if(!self->private_key) {
+        zsys_error("zsimpledisco: unable to load private key from %s", path);
+        return 1;
+    }
+    return 0;
+}
+
+int
+s_self_bind(self_t *self, const char *endpoint)
+{
+    if(self->verbose)
+        zsys_info("zsimpledisco: binding to %s", endpoint);
+
+    if(self->private_key) {
+        zcert_apply (self->private_key, self->server_socket);
+        zsock_set_curve_server (self->server_socket, 1);
+        assert (zsock_mechanism (self->server_socket) == ZMQ_CURVE);
     }
 
     return -1 == zsock_bind (self->server_socket, "%s", endpoint);
 }
 
+//  FNV-1a, continuing from hash
+static uint64_t
+s_fnv1a(uint64_t hash, const void *data, size_t size)
+{
+    const byte *bytes = (const byte *) data;
+    while (size--) {
+        hash ^= *bytes++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+#define FNV1A_BASIS 14695981039346656037ULL
+
+static size_t
+s_sync_bucket(const char *key)
+{
+    return (size_t) (s_fnv1a(FNV1A_BASIS, key, strlen(key)) % SYNC_BUCKETS);
+}
+
+static int64_t
+s_record_ts(value_t *record)
+{
+    return record->lease ? record->lease->ts : record->ts;
+}
+
 static int
-s_self_add_kv(self_t *self, const char *key, char *value)
+s_self_ttl(self_t *self, int ttl)
+{
+    return ttl > 0 ? ttl : self->cleanup_max_age;
+}
+
+//  Keep the bucket digest in step with a record's key, value and timestamp.
+//  Timestamps count as wall clock slots, so servers agree on refreshed
+//  records without agreeing on the exact millisecond.
+static void
+s_self_update_digest(self_t *self, value_t *record)
+{
+    size_t bucket = s_sync_bucket(record->key);
+    self->digests[bucket] ^= record->digest;
+    record->digest = 0;
+    if(record->value) {
+        int64_t slot = (zclock_time() - (zclock_mono() - s_record_ts(record))) / self->sync_slot;
+        uint64_t hash = s_fnv1a(FNV1A_BASIS, record->key, strlen(record->key) + 1);
+        hash = s_fnv1a(hash, record->value, strlen(record->value) + 1);
+        record->digest = s_fnv1a(hash, &slot, sizeof (slot));
+    }
+    self->digests[bucket] ^= record->digest;
+}
+
+//  Push a change to every client watching a matching prefix
+static void
+s_self_notify_watchers(self_t *self, value_t *record)
+{
+    watcher_t *watcher;
+    for (watcher = zregistry_first (self->watchers); watcher != NULL; watcher = zregistry_next (self->watchers)) {
+        if(strncmp(record->key, watcher->prefix, strlen(watcher->prefix)))
+            continue;
+        zframe_send(&watcher->routing_id, self->server_socket, ZFRAME_MORE | ZFRAME_REUSE);
+        zstr_sendm(self->server_socket, "EVENT");
+        zstr_sendm(self->server_socket, self->epoch);
+        zstr_sendfm(self->server_socket, "%" PRIu64, record->generation);
+        if(record->value)
+            zstr_sendx(self->server_socket, "SET", record->key, record->value, NULL);
+        else
+            zstr_sendx(self->server_socket, "EXPIRE", record->key, NULL);
+    }
+}
+
+//  Mark a record as changed in the current generation
+static void
+s_self_record_changed(self_t *self, value_t *record)
+{
+    record->generation = ++self->generation;
+    if(record->change_handle)
+        zlistx_move_end(self->changes, record->change_handle);
+    else
+        record->change_handle = zlistx_add_end(self->changes, record);
+    s_self_notify_watchers(self, record);
+}
+
+//  Start or renew pushing changes to a client
+static void
+s_self_add_watcher(self_t *self, zframe_t *routing_id, const char *prefix)
 {
-    value_t *record = (value_t *) zmalloc (sizeof (value_t));
-    record->value = strdup(value);
+    char *id = zframe_strhex(routing_id);
+    watcher_t *watcher = (watcher_t *) zregistry_lookup (self->watchers, id);
+    if(!watcher) {
+        watcher = (watcher_t *) zmalloc (sizeof (watcher_t));
+        watcher->routing_id = zframe_dup(routing_id);
+        zregistry_insert (self->watchers, id, watcher);
+    }
+    if(!watcher->prefix || strneq(watcher->prefix, prefix)) {
+        free(watcher->prefix);
+        watcher->prefix = strdup(prefix);
+    }
+    watcher->expires = zclock_mono() + self->cleanup_max_age;
+    zstr_free(&id);
+}
+
+static void
+s_self_expire_watchers(self_t *self)
+{
+    int64_t now = zclock_mono();
+    watcher_t *watcher;
+    for (watcher = zregistry_first (self->watchers); watcher != NULL; watcher = zregistry_next (self->watchers)) {
+        if(watcher->expires < now) {
+            const char *id = zregistry_cursor (self->watchers);
+            if (self->verbose)
+                zsys_debug("zsimpledisco: watch from %s lapsed", id);
+            zregistry_delete (self->watchers, id);
+        }
+    }
+}
+
+//  Give the record its own expiry again
+static void
+s_self_lease_detach(self_t *self, value_t *record)
+{
+    (void) self;
+    if(!record->lease)
+        return;
+    zlistx_delete(record->lease->records, record->lease_handle);
+    record->lease = NULL;
+    record->lease_handle = NULL;
+}
+
+static lease_t *
+s_self_new_lease(self_t *self)
+{
+    lease_t *lease = (lease_t *) zmalloc (sizeof (lease_t));
+    lease->id = zsys_sprintf("%s-%u", self->epoch, ++self->lease_count);
+    lease->ts = zclock_mono();
+    lease->ttl = self->cleanup_max_age;
+    lease->digest_slot = zclock_time() / self->sync_slot;
+    lease->records = zlistx_new();
+    zexpiry_set(self->lease_expiry, lease, &lease->expiry_slot, lease->ts + lease->ttl);
+    zregistry_insert(self->leases, lease->id, lease);
+    return lease;
+}
+
+//  Hand a freshly refreshed record over to lease, it stops expiring on its
+//  own. The lease lapses as soon as its shortest lived record would.
+static void
+s_self_lease_attach(self_t *self, lease_t *lease, value_t *record)
+{
+    s_self_lease_detach(self, record);
+    zexpiry_remove(self->expiry, &record->expiry_slot);
+    record->lease = lease;
+    record->lease_handle = zlistx_add_end(lease->records, record);
+    if(s_self_ttl(self, record->ttl) < lease->ttl) {
+        lease->ttl = s_self_ttl(self, record->ttl);
+        zexpiry_set(self->lease_expiry, lease, &lease->expiry_slot, lease->ts + lease->ttl);
+    }
+}
+
+//  Refresh every record of a lease at once. Their digests only change
+//  when the refresh moves into another wall clock slot.
+static bool
+s_self_renew_lease(self_t *self, const char *id)
+{
+    lease_t *lease = (lease_t *) zregistry_lookup (self->leases, id);
+    if(!lease)
+        return false;
+    lease->ts = zclock_mono();
+    zexpiry_set(self->lease_expiry, lease, &lease->expiry_slot, lease->ts + lease->ttl);
+    int64_t digest_slot = zclock_time() / self->sync_slot;
+    if(digest_slot != lease->digest_slot) {
+        lease->digest_slot = digest_slot;
+        value_t *record;
+        for (record = zlistx_first (lease->records); record != NULL; record = zlistx_next (lease->records))
+            s_self_update_digest(self, record);
+    }
+    return true;
+}
+
+//  Store a key/value last refreshed at ts, expiring ttl msecs later (0 for
+//  the default). Only a new key or value is a change, a refresh with the
+//  same value just moves the timestamp.
+static value_t *
+s_self_set_kv(self_t *self, const char *key, const char *value, int64_t ts, int ttl)
+{
+    bool changed = true;
+    value_t *record = (value_t *) zregistry_lookup (self->data, key);
+    if(record) {
+        if(streq(record->value, value))
+            changed = false;
+        else {
+            s_self_strfree(self, &record->value);
+            record->value = s_self_strdup(self, value);
+        }
+    }
+    else {
+        //  Bring back a recently expired key, or start a new one
+        record = (value_t *) zregistry_lookup (self->tombstones, key);
+        if(record)
+            zregistry_delete (self->tombstones, key);
+        else {
+            record = (value_t *) zslab_alloc (self->record_slab);
+            record->key = s_self_strdup(self, key);
+        }
+        record->value = s_self_strdup(self, value);
+        zregistry_insert (self->data, key, record);
+    }
+    s_self_lease_detach(self, record);
+    record->ts = ts;
+    record->ttl = ttl;
+    zexpiry_set(self->expiry, record, &record->expiry_slot, record->ts + s_self_ttl(self, record->ttl));
+    s_self_update_digest(self, record);
+    if(changed)
+        s_self_record_changed(self, record);
+    return record;
+}
+
+static int
+s_self_add_kv(self_t *self, const char *key, char *value, int ttl)
+{
+    s_self_set_kv(self, key, value, zclock_mono(), ttl);
+    return 0;
+}
+
+//  Replace an expired record with a tombstone so deltas can report it
+static void
+s_self_expire_kv(self_t *self, value_t *record)
+{
+    zregistry_delete (self->data, record->key);
+    zexpiry_remove (self->expiry, &record->expiry_slot);
+    s_self_lease_detach(self, record);
+    s_self_strfree(self, &record->value);
+    s_self_update_digest(self, record);
     record->ts = zclock_mono();
-    zhash_update (self->data, key, record);
-    zhash_freefn (self->data, key, value_t_free);
+    zregistry_insert (self->tombstones, record->key, record);
+    s_self_record_changed(self, record);
+}
+
+//  Forget tombstones that are too old; deltas from before them become full snapshots
+static void
+s_self_expire_tombstones(self_t *self)
+{
+    int64_t cutoff = zclock_mono() - self->tombstone_max_age;
+    value_t *record;
+    for (record = zregistry_first (self->tombstones); record != NULL; record = zregistry_next (self->tombstones)) {
+        if(record->ts >= cutoff)
+            continue;
+        if(record->generation > self->oldest_generation)
+            self->oldest_generation = record->generation;
+        zregistry_delete (self->tombstones, record->key);
+        zlistx_delete (self->changes, record->change_handle);
+        s_self_record_free(self, record);
+    }
+}
+
+//  Packed key/value snapshot of data, only rebuilt after data has changed
+static zframe_t *
+s_self_snapshot(self_t *self)
+{
+    if(!self->snapshot || self->snapshot_generation != self->generation) {
+        zframe_destroy(&self->snapshot);
+        self->snapshot = zregistry_pack(self->data, s_record_value);
+        self->snapshot_generation = self->generation;
+        self->stats.snapshot_packs++;
+        if (self->verbose)
+            zsys_debug("zsimpledisco: packed snapshot at generation %" PRIu64 ", %zu bytes",
+                self->generation, zframe_size(self->snapshot));
+    }
+    return self->snapshot;
+}
+
+//  Answer VALUES SINCE with either everything that changed after the
+//  client's generation, or a full snapshot when that is not possible.
+static void
+s_self_send_values_since(self_t *self, zframe_t **routing_id_p, const char *epoch, const char *since_str)
+{
+    uint64_t since = since_str ? strtoull(since_str, NULL, 10) : 0;
+    bool full = !epoch || strneq(epoch, self->epoch)
+        || since < self->oldest_generation || since > self->generation;
+
+    zregistry_t *removed = zregistry_new();
+    zframe_t *set_frame;
+    if(full)
+        set_frame = s_self_snapshot(self);
+    else {
+        zregistry_t *set = zregistry_new();
+        value_t *record;
+        for (record = zlistx_last (self->changes); record != NULL; record = zlistx_prev (self->changes)) {
+            if(record->generation <= since)
+                break;
+            if(record->value)
+                zregistry_update(set, record->key, record->value);
+            else
+                zregistry_update(removed, record->key, "");
+        }
+        set_frame = zregistry_pack(set, NULL);
+        zregistry_destroy(&set);
+    }
+    if (self->verbose)
+        zsys_debug("zsimpledisco: VALUES SINCE %s: %s %zu bytes, %zu removed", since_str ? since_str : "",
+            full ? "FULL" : "DELTA", zframe_size(set_frame), zregistry_size(removed));
+
+    zframe_send(routing_id_p, self->server_socket, ZFRAME_MORE);
+    zstr_sendm(self->server_socket, self->epoch);
+    zstr_sendfm(self->server_socket, "%" PRIu64, self->generation);
+    zstr_sendm(self->server_socket, full ? "FULL" : "DELTA");
+    //  The shared snapshot is reused, zmq only adds a reference to it
+    zframe_send(&set_frame, self->server_socket, ZFRAME_MORE | (full ? ZFRAME_REUSE : 0));
+    zframe_t *removed_frame = zregistry_pack(removed, NULL);
+    zframe_send(&removed_frame, self->server_socket, 0);
+    zregistry_destroy(&removed);
+}
+
+//  Keys like tcp://*:5670 are published as the address the client connected from
+static char *
+s_self_rewrite_key(self_t *self, char *key, const char *peer_address)
+{
+    if(key && peer_address && strlen(key) > 8 && key[6] == '*') {
+        char *new_key = zsys_sprintf("tcp://%s%s", peer_address, &key[7]);
+        if (self->verbose)
+            zsys_debug("zsimpledisco: Rewrote %s to %s", key, new_key);
+        zstr_free(&key);
+        key = new_key;
+    }
+    return key;
+}
+
+//  Adopt a record from a replica unless ours was refreshed more recently
+static void
+s_self_merge_kv(self_t *self, const char *key, const char *value, int64_t age, int ttl)
+{
+    if(age < 0 || age >= s_self_ttl(self, ttl))
+        return;
+    int64_t ts = zclock_mono() - age;
+    value_t *record = (value_t *) zregistry_lookup (self->data, key);
+    if(record && s_record_ts(record) >= ts)
+        return;
+    //  Our lease is alive, the replica only has an older refresh of it
+    if(record && record->lease && streq(record->value, value))
+        return;
+    if (self->verbose)
+        zsys_debug("zsimpledisco: sync key='%s' value='%s' age='%ld'", key, value, age / 1000);
+    s_self_set_kv(self, key, value, ts, ttl);
+}
+
+//  Merge the key, value, age, TTL records left in msg
+static size_t
+s_self_merge_sync_records(self_t *self, zmsg_t *msg)
+{
+    size_t count = 0;
+    while (zmsg_size(msg) >= 4) {
+        char *key = zmsg_popstr(msg);
+        char *value = zmsg_popstr(msg);
+        char *age = zmsg_popstr(msg);
+        char *ttl = zmsg_popstr(msg);
+        s_self_merge_kv(self, key, value, strtoll(age, NULL, 10), atoi(ttl));
+        zstr_free (&key);
+        zstr_free (&value);
+        zstr_free (&age);
+        zstr_free (&ttl);
+        count++;
+    }
+    return count;
+}
+
+//  Append a frame listing the buckets, then our records in those buckets.
+//  Records go with their age, our monotonic clock means nothing elsewhere.
+static void
+s_self_add_sync_records(self_t *self, zmsg_t *msg, const bool *buckets)
+{
+    byte bucket_ids [SYNC_BUCKETS];
+    size_t bucket_count = 0;
+    size_t bucket;
+    for (bucket = 0; bucket < SYNC_BUCKETS; bucket++)
+        if(buckets[bucket])
+            bucket_ids[bucket_count++] = (byte) bucket;
+    zmsg_addmem(msg, bucket_ids, bucket_count);
+
+    int64_t now = zclock_mono();
+    value_t *record;
+    for (record = zregistry_first (self->data); record != NULL; record = zregistry_next (self->data)) {
+        if(!buckets[s_sync_bucket(record->key)])
+            continue;
+        zmsg_addstr(msg, record->key);
+        zmsg_addstr(msg, record->value);
+        zmsg_addstrf(msg, "%" PRId64, now - s_record_ts(record));
+        zmsg_addstrf(msg, "%d", record->ttl);
+    }
+}
+
+//  Read the bucket frame of a SYNC-RECORDS or SYNC-PUSH message
+static void
+s_sync_buckets_pop(zmsg_t *msg, bool *buckets)
+{
+    memset(buckets, 0, SYNC_BUCKETS * sizeof (bool));
+    zframe_t *frame = zmsg_pop(msg);
+    if(!frame)
+        return;
+    byte *data = zframe_data(frame);
+    size_t index;
+    for (index = 0; index < zframe_size(frame); index++)
+        buckets[data[index]] = true;
+    zframe_destroy(&frame);
+}
+
+//  A replica sent its digests: answer with our records in every bucket
+//  that differs, it pushes its own records for those buckets back.
+static void
+s_self_handle_sync(self_t *self, zframe_t **routing_id_p, zframe_t *digest_frame)
+{
+    if(!digest_frame || zframe_size(digest_frame) != SYNC_BUCKETS * 8)
+        return;
+    bool buckets [SYNC_BUCKETS];
+    size_t differing = 0;
+    byte *data = zframe_data(digest_frame);
+    size_t bucket;
+    for (bucket = 0; bucket < SYNC_BUCKETS; bucket++) {
+        uint64_t digest = 0;
+        int index;
+        for (index = 0; index < 8; index++)
+            digest = (digest << 8) | data[bucket * 8 + index];
+        buckets[bucket] = digest != self->digests[bucket];
+        if(buckets[bucket])
+            differing++;
+    }
+    if (self->verbose)
+        zsys_debug("zsimpledisco: SYNC found %zu differing buckets", differing);
+
+    zmsg_t *reply = zmsg_new();
+    zmsg_addstr(reply, "SYNC-RECORDS");
+    s_self_add_sync_records(self, reply, buckets);
+    zframe_send (routing_id_p, self->server_socket, ZFRAME_MORE);
+    zmsg_send (&reply, self->server_socket);
+}
+
+//  The replica answered our SYNC with its records in the differing buckets
+static void
+s_self_handle_replica_reply(self_t *self, peer_t *replica, zmsg_t *msg)
+{
+    char *command = zmsg_popstr(msg);
+    if(command && streq(command, "SYNC-RECORDS")) {
+        replica->pending = 0;
+        bool buckets [SYNC_BUCKETS];
+        s_sync_buckets_pop(msg, buckets);
+
+        //  Collect ours before merging theirs, so theirs aren't sent back
+        zmsg_t *push = zmsg_new();
+        zmsg_addstr(push, "SYNC-PUSH");
+        s_self_add_sync_records(self, push, buckets);
+        size_t count = s_self_merge_sync_records(self, msg);
+        if (self->verbose)
+            zsys_debug("zsimpledisco: merged %zu records from replica %s", count, replica->endpoint);
+        if(zmsg_size(push) > 2)
+            zmsg_send(&push, replica->sock);
+        zmsg_destroy(&push);
+    }
+    zstr_free(&command);
+}
+
+//  Send our digests to every replica that answered the previous round.
+//  A replica that didn't answer in time gets a fresh connection.
+static void
+s_self_sync_replicas(self_t *self)
+{
+    byte digests [SYNC_BUCKETS * 8];
+    size_t bucket;
+    for (bucket = 0; bucket < SYNC_BUCKETS; bucket++) {
+        int index;
+        for (index = 0; index < 8; index++)
+            digests[bucket * 8 + index] = (byte) (self->digests[bucket] >> (56 - 8 * index));
+    }
+
+    int64_t now = zclock_mono();
+    peer_t *replica;
+    for (replica = zregistry_first (self->replicas); replica != NULL; replica = zregistry_next (self->replicas)) {
+        if(replica->pending) {
+            if(now - replica->request_sent < self->peer_timeout)
+                continue;
+            if (self->verbose)
+                zsys_debug("zsimpledisco: replica %s did not answer SYNC, reconnecting", replica->endpoint);
+            replica->timeouts++;
+            s_self_close_peer_socket(self, replica);
+            replica->sock = s_self_peer_socket(self, replica->endpoint);
+            replica->pending = 0;
+            if(!replica->sock)
+                continue;
+        }
+        zmsg_t *msg = zmsg_new();
+        zmsg_addstr(msg, "SYNC");
+        zmsg_addmem(msg, digests, sizeof (digests));
+        if(-1 == zmsg_send(&msg, replica->sock)) {
+            zmsg_destroy(&msg);
+            continue;
+        }
+        replica->pending = 1;
+        replica->request_sent = now;
+    }
+}
+
+static int
+s_self_replicate(self_t *self, const char *endpoint)
+{
+    if(zregistry_lookup(self->replicas, endpoint))
+        return 0;
+    peer_t *replica = s_self_new_peer(self, endpoint);
+    if(!replica)
+        return -1;
+    zregistry_insert(self->replicas, endpoint, replica);
+    //  Compare with the new replica right away
+    s_self_timer_at(self, self->sync_timer, zclock_mono());
     return 0;
 }
 
+static void
+s_histogram_add(histogram_t *histogram, int64_t usecs)
+{
+    size_t bucket = 0;
+    while (bucket < STATS_BOUNDS && usecs > s_stats_bounds[bucket])
+        bucket++;
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    histogram->sum += usecs;
+}
+
+static void
+s_stats_append(char **text_p, const char *format, ...)
+{
+    va_list argptr;
+    va_start(argptr, format);
+    char *line = zsys_vprintf(format, argptr);
+    va_end(argptr);
+    char *text = zsys_sprintf("%s%s", *text_p ? *text_p : "", line);
+    zstr_free(text_p);
+    zstr_free(&line);
+    *text_p = text;
+}
+
+static void
+s_stats_append_histogram(char **text_p, const char *name, const char *help, histogram_t *histogram)
+{
+    s_stats_append(text_p, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    uint64_t cumulative = 0;
+    size_t bucket;
+    for (bucket = 0; bucket < STATS_BOUNDS; bucket++) {
+        cumulative += histogram->buckets[bucket];
+        s_stats_append(text_p, "%s_bucket{le=\"%g\"} %" PRIu64 "\n", name, s_stats_bounds[bucket] / 1e6, cumulative);
+    }
+    s_stats_append(text_p, "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n", name, histogram->count);
+    s_stats_append(text_p, "%s_sum %g\n%s_count %" PRIu64 "\n", name, histogram->sum / 1e6, name, histogram->count);
+}
+
+static void
+s_stats_append_value(char **text_p, const char *name, const char *type, const char *help, uint64_t value)
+{
+    s_stats_append(text_p, "# HELP %s %s\n# TYPE %s %s\n%s %" PRIu64 "\n", name, help, name, type, name, value);
+}
+
+//  Everything in STATS, in the Prometheus text format
+static char *
+s_self_stats(self_t *self)
+{
+    stats_t *stats = &self->stats;
+    char *text = NULL;
+    s_stats_append(&text, "# HELP disco_requests_total Server requests by command\n"
+        "# TYPE disco_requests_total counter\n");
+    size_t command;
+    for (command = 0; command < STATS_COMMANDS; command++)
+        s_stats_append(&text, "disco_requests_total{command=\"%s\"} %" PRIu64 "\n",
+            s_stats_commands[command], stats->requests[command]);
+    s_stats_append_value(&text, "disco_requests_unauthorized_total", "counter",
+        "Server requests from keys not in the allowlist", stats->unauthorized);
+    s_stats_append_histogram(&text, "disco_publish_seconds",
+        "Time to handle PUBLISH and PUBLISH-BATCH", &stats->publish_latency);
+    s_stats_append_histogram(&text, "disco_values_seconds",
+        "Time to handle VALUES and VALUES SINCE", &stats->values_latency);
+    s_stats_append_histogram(&text, "disco_loop_lag_seconds",
+        "Time from the actor waking up until it polls again", &stats->loop_lag);
+    s_stats_append_value(&text, "disco_keys", "gauge", "Live keys on the server", zregistry_size(self->data));
+    s_stats_append_value(&text, "disco_tombstones", "gauge", "Expired keys remembered for deltas", zregistry_size(self->tombstones));
+    s_stats_append_value(&text, "disco_leases", "gauge", "Client leases on the server", zregistry_size(self->leases));
+    s_stats_append_value(&text, "disco_watchers", "gauge", "Clients watching for changes", zregistry_size(self->watchers));
+    s_stats_append_value(&text, "disco_keys_expired_total", "counter", "Keys expired on the server", stats->keys_expired);
+    s_stats_append_value(&text, "disco_leases_expired_total", "counter", "Client leases that lapsed", stats->leases_expired);
+    s_stats_append_value(&text, "disco_snapshot_bytes", "gauge", "Size of the packed VALUES snapshot",
+        self->snapshot ? zframe_size(self->snapshot) : 0);
+    s_stats_append_value(&text, "disco_snapshot_packs_total", "counter", "Times the VALUES snapshot was packed", stats->snapshot_packs);
+    s_stats_append_value(&text, "disco_peers", "gauge", "Servers the client side is connected to", zregistry_size(self->client_peers));
+    s_stats_append_value(&text, "disco_reconnects_total", "counter", "Servers the client side reconnected to", stats->reconnects);
+    s_stats_append(&text, "# HELP disco_peer_timeouts_total Requests a server or replica didn't answer in time\n"
+        "# TYPE disco_peer_timeouts_total counter\n");
+    peer_t *peer;
+    for (peer = zregistry_first (self->client_peers); peer != NULL; peer = zregistry_next (self->client_peers))
+        s_stats_append(&text, "disco_peer_timeouts_total{endpoint=\"%s\",role=\"server\"} %" PRIu64 "\n", peer->endpoint, peer->timeouts);
+    for (peer = zregistry_first (self->replicas); peer != NULL; peer = zregistry_next (self->replicas))
+        s_stats_append(&text, "disco_peer_timeouts_total{endpoint=\"%s\",role=\"replica\"} %" PRIu64 "\n", peer->endpoint, peer->timeouts);
+    return text;
+}
+
+static size_t
+s_stats_command(const char *command)
+{
+    size_t index;
+    for (index = 0; index < STATS_COMMANDS - 1; index++)
+        if(streq(command, s_stats_commands[index]))
+            break;
+    return index;
+}
+
 static int
 s_self_handle_server_socket (self_t *self)
 {
+    int64_t start = zclock_usecs();
     zframe_t *routing_id = zframe_recv (self->server_socket);
     zframe_t *command_frame = zframe_recv(self->server_socket);
     char *command = zframe_strdup(command_frame);
     const char *peer_address = zframe_meta(command_frame, "Peer-Address");
-    if(self->certstore) {
+    if(self->allowlist) {
         const char *peer_public_key = zframe_meta(command_frame, "User-Id");
-        if(!zcertstore_lookup(self->certstore, peer_public_key)) {
+        if(!peer_public_key || !zregistry_lookup(self->allowlist, peer_public_key)) {
             if (self->verbose)
                 zsys_info("zsimpledisco: Peer key %s no longer in certstore, ignoring.", peer_public_key);
+            self->stats.unauthorized++;
             goto out;
         }
     }
 
     if (self->verbose)
         zsys_info ("zsimpledisco: server peer=%s command=%s", peer_address ? peer_address: "", command);
+    self->stats.requests[s_stats_command(command)]++;
     if (streq (command, "PUBLISH")) {
         char *key = zstr_recv(self->server_socket);
         char *value = zstr_recv(self->server_socket);
-        if(key && strlen(key) > 8 && key[6] == '*') {
-            char *new_key = zsys_sprintf("tcp://%s%s", peer_address, &key[7]);
-            if (self->verbose)
-                zsys_debug("zsimpledisco: Rewrote %s to %s", key, new_key);
-            zstr_free(&key);
-            key = new_key;
-        }
+        char *ttl = zsock_rcvmore(self->server_socket) ? zstr_recv(self->server_socket) : NULL;
+        key = s_self_rewrite_key(self, key, peer_address);
         if (self->verbose)
-            zsys_info ("zsimpledisco: server PUBLISH '%s' '%s'", key, value);
-        s_self_add_kv(self, key, value);
+            zsys_info ("zsimpledisco: server PUBLISH '%s' '%s' ttl=%s", key, value, ttl ? ttl : "default");
+        s_self_add_kv(self, key, value, ttl ? atoi(ttl) : 0);
         zstr_free (&key);
         zstr_free (&value);
+        zstr_free (&ttl);
         zframe_send (&routing_id, self->server_socket, ZFRAME_MORE);
         if(-1 == zstr_send(self->server_socket, "OK")) {
             if (self->verbose)
@@ -504,58 +1940,503 @@ s_self_handle_server_socket (self_t *self)
         }
     }
     else
+    if (streq (command, "PUBLISH-BATCH") || streq (command, "PUBLISH-BATCH-TTL")) {
+        zmsg_t *batch = zsock_rcvmore(self->server_socket) ? zmsg_recv(self->server_socket) : NULL;
+        size_t stride = streq (command, "PUBLISH-BATCH-TTL") ? 3 : 2;
+        //  The keys are kept alive by RENEW of their lease from now on
+        lease_t *lease = batch && zmsg_size(batch) >= stride ? s_self_new_lease(self) : NULL;
+        size_t count = 0;
+        while (batch && zmsg_size(batch) >= stride) {
+            char *key = s_self_rewrite_key(self, zmsg_popstr(batch), peer_address);
+            char *value = zmsg_popstr(batch);
+            char *ttl = stride == 3 ? zmsg_popstr(batch) : NULL;
+            if (self->verbose)
+                zsys_debug ("zsimpledisco: server %s '%s' '%s'", command, key, value);
+            s_self_lease_attach(self, lease, s_self_set_kv(self, key, value, zclock_mono(), ttl ? atoi(ttl) : 0));
+            zstr_free (&key);
+            zstr_free (&value);
+            zstr_free (&ttl);
+            count++;
+        }
+        if (self->verbose)
+            zsys_info ("zsimpledisco: server PUBLISH-BATCH of %zu keys", count);
+        zmsg_destroy(&batch);
+        zframe_send (&routing_id, self->server_socket, ZFRAME_MORE);
+        if(-1 == zstr_sendx(self->server_socket, "OK", lease ? lease->id : NULL, NULL)) {
+            if (self->verbose)
+                zsys_info("zsimpledisco: send failed");
+        }
+    }
+    else
+    if (streq (command, "RENEW")) {
+        char *lease = zsock_rcvmore(self->server_socket) ? zstr_recv(self->server_socket) : NULL;
+        bool renewed = lease && s_self_renew_lease(self, lease);
+        if (self->verbose)
+            zsys_debug ("zsimpledisco: server RENEW '%s' %s", lease ? lease : "", renewed ? "OK" : "UNKNOWN");
+        zframe_send (&routing_id, self->server_socket, ZFRAME_MORE);
+        if(-1 == zstr_send(self->server_socket, renewed ? "OK" : "UNKNOWN")) {
+            if (self->verbose)
+                zsys_info("zsimpledisco: send failed");
+        }
+        zstr_free (&lease);
+    }
+    else
+    if (streq (command, "WATCH")) {
+        char *prefix = zsock_rcvmore(self->server_socket) ? zstr_recv(self->server_socket) : NULL;
+        s_self_add_watcher(self, routing_id, prefix ? prefix : "");
+        zstr_free (&prefix);
+    }
+    else
     if (streq (command, "VALUES")) {
         zframe_send (&routing_id, self->server_socket, ZFRAME_MORE);
-        zhash_t *kvhash = convert_hash(self->data);
-        zframe_t *all_data =  zhash_pack (kvhash);
-        zframe_send (&all_data, self->server_socket, 0);
-        zhash_destroy(&kvhash);
+        zframe_t *all_data = s_self_snapshot(self);
+        zframe_send (&all_data, self->server_socket, ZFRAME_REUSE);
+    }
+    else
+    if (streq (command, "VALUES SINCE")) {
+        char *epoch = zstr_recv(self->server_socket);
+        char *since = zstr_recv(self->server_socket);
+        s_self_send_values_since(self, &routing_id, epoch, since);
+        zstr_free (&epoch);
+        zstr_free (&since);
+    }
+    else
+    if (streq (command, "PING")) {
+        zframe_send (&routing_id, self->server_socket, ZFRAME_MORE);
+        zstr_send (self->server_socket, "PONG");
+    }
+    else
+    if (streq (command, "STATS")) {
+        char *stats = s_self_stats(self);
+        zframe_send (&routing_id, self->server_socket, ZFRAME_MORE);
+        zstr_send (self->server_socket, stats);
+        zstr_free (&stats);
+    }
+    else
+    if (streq (command, "SYNC")) {
+        zframe_t *digest_frame = zsock_rcvmore(self->server_socket) ? zframe_recv(self->server_socket) : NULL;
+        s_self_handle_sync(self, &routing_id, digest_frame);
+        zframe_destroy(&digest_frame);
+    }
+    else
+    if (streq (command, "SYNC-PUSH")) {
+        zmsg_t *push = zsock_rcvmore(self->server_socket) ? zmsg_recv(self->server_socket) : NULL;
+        if(push) {
+            bool buckets [SYNC_BUCKETS];
+            s_sync_buckets_pop(push, buckets);
+            size_t count = s_self_merge_sync_records(self, push);
+            if (self->verbose)
+                zsys_info ("zsimpledisco: server SYNC-PUSH of %zu records", count);
+        }
+        zmsg_destroy(&push);
     }
 
+    if (streq (command, "PUBLISH") || streq (command, "PUBLISH-BATCH") || streq (command, "PUBLISH-BATCH-TTL"))
+        s_histogram_add(&self->stats.publish_latency, zclock_usecs() - start);
+    else
+    if (streq (command, "VALUES") || streq (command, "VALUES SINCE"))
+        s_histogram_add(&self->stats.values_latency, zclock_usecs() - start);
+
 out:
     zstr_free (&command);
     zframe_destroy(&command_frame);
+    zframe_destroy(&routing_id);
     return 0;
 }
 
+//  Only the records that actually expired are visited, oldest first
 static int
 s_self_handle_expire_data(self_t *self)
 {
-    zlist_t *keys_to_delete = zlist_new();
-
     value_t *item;
     int64_t now = zclock_mono();
-    int64_t expiration_cuttoff = now - self->cleanup_max_age;
-    for (item = zhash_first (self->data); item != NULL; item = zhash_next (self->data)) {
-        const char *key = zhash_cursor (self->data);
-        if(item->ts < expiration_cuttoff) {
-            if (self->verbose)
-                zsys_debug("zsimpledisco: expire key='%s' value='%s' ts='%ld' age='%ld'", key, item->value, item->ts, (now-item->ts) / 1000);
-            if(-1 == zlist_append(keys_to_delete, (void *)key)) {
-                zsys_error("zsimpledisco: zlist_append failed");
+    while ((item = (value_t *) zexpiry_pop_expired (self->expiry, now))) {
+        if (self->verbose)
+            zsys_debug("zsimpledisco: expire key='%s' value='%s' ts='%ld' age='%ld'", item->key, item->value, item->ts, (now-item->ts) / 1000);
+        s_self_expire_kv(self, item);
+        self->stats.keys_expired++;
+    }
+
+    //  A lapsed lease takes its keys with it, those with a longer TTL
+    //  are left to expire on their own
+    lease_t *lease;
+    while ((lease = (lease_t *) zexpiry_pop_expired (self->lease_expiry, now))) {
+        if (self->verbose)
+            zsys_debug("zsimpledisco: expire lease='%s' keys='%zu'", lease->id, zlistx_size(lease->records));
+        value_t *record;
+        while ((record = (value_t *) zlistx_first (lease->records))) {
+            int64_t deadline = lease->ts + s_self_ttl(self, record->ttl);
+            if(deadline > now) {
+                record->ts = lease->ts;
+                s_self_lease_detach(self, record);
+                zexpiry_set(self->expiry, record, &record->expiry_slot, deadline);
+                continue;
             }
+            s_self_expire_kv(self, record);
+            self->stats.keys_expired++;
         }
+        self->stats.leases_expired++;
+        zregistry_delete (self->leases, lease->id);
     }
-    const char *del = (const char *) zlist_first (keys_to_delete);
-    while (del) {
-        zhash_delete(self->data, del);
-        del = (const char *) zlist_next (keys_to_delete);
+    s_self_expire_tombstones(self);
+    return 0;
+}
+
+static size_t
+s_state_write_record(FILE *file, int64_t now, value_t *record)
+{
+    state_record_t state_record = { now - s_record_ts(record), (uint32_t) strlen(record->key),
+        record->value ? (uint32_t) strlen(record->value) : 0, record->ttl,
+        record->value ? 0 : STATE_RECORD_REMOVED };
+    fwrite(&state_record, sizeof (state_record), 1, file);
+    fwrite(record->key, 1, state_record.key_size, file);
+    if(record->value)
+        fwrite(record->value, 1, state_record.value_size, file);
+    return sizeof (state_record) + state_record.key_size + state_record.value_size;
+}
+
+static void
+s_state_header(state_header_t *header, const char *magic, uint32_t count, uint32_t sequence)
+{
+    memset(header, 0, sizeof (*header));
+    memcpy(header->magic, magic, sizeof (header->magic));
+    header->saved = zclock_time();
+    header->count = count;
+    header->sequence = sequence;
+}
+
+//  Write the live records to the state file and empty the log. The file is
+//  replaced as a whole, so a crash mid-save leaves the previous one in
+//  place; a crash before the log is emptied leaves batches the new file
+//  already includes, which loading skips by their number.
+static int
+s_self_compact_state(self_t *self)
+{
+    char *tmp_path = zsys_sprintf("%s.tmp", self->state_path);
+    FILE *file = fopen(tmp_path, "wb");
+    if(!file) {
+        zsys_error("zsimpledisco: unable to write state to %s: %s", tmp_path, strerror(errno));
+        zstr_free(&tmp_path);
+        return -1;
     }
-    zlist_destroy(&keys_to_delete);
+
+    int64_t now = zclock_mono();
+    state_header_t header;
+    s_state_header(&header, STATE_FILE_MAGIC, (uint32_t) zregistry_size(self->data), self->state_sequence);
+    fwrite(&header, sizeof (header), 1, file);
+    size_t size = sizeof (header);
+    value_t *record;
+    for (record = zregistry_first (self->data); record != NULL; record = zregistry_next (self->data))
+        size += s_state_write_record(file, now, record);
+
+    int rc = ferror(file) ? -1 : 0;
+    if(fclose(file))
+        rc = -1;
+    if(rc == 0 && rename(tmp_path, self->state_path))
+        rc = -1;
+    if(rc == 0 && truncate(self->state_log_path, 0) && errno != ENOENT)
+        rc = -1;
+    if(rc)
+        zsys_error("zsimpledisco: unable to save state to %s: %s", self->state_path, strerror(errno));
+    else {
+        self->state_generation = self->generation;
+        self->state_size = size;
+        self->state_log_size = 0;
+        self->state_compacted = now;
+        if (self->verbose)
+            zsys_debug("zsimpledisco: saved %u records to %s", header.count, self->state_path);
+    }
+    zstr_free(&tmp_path);
+    return rc;
+}
+
+//  Append the records that changed or expired since the last save to the
+//  log, nothing at all if none did. Renewals and refreshes that keep the
+//  value aren't logged, so their saved age grows stale; the state file is
+//  rewritten once it is half the max age old, even if nothing changed, so
+//  a restart restores what is still being refreshed. It is also rewritten
+//  once the log outgrows it.
+static int
+s_self_save_state(self_t *self)
+{
+    int64_t now = zclock_mono();
+    //  Tombstones that went before we logged them make a log incomplete
+    if(self->oldest_generation > self->state_generation
+    || self->state_log_size > self->state_size
+    || now - self->state_compacted > self->cleanup_max_age / 2)
+        return s_self_compact_state(self);
+    if(self->generation == self->state_generation)
+        return 0;
+
+    uint32_t count = 0;
+    value_t *record;
+    for (record = zlistx_last (self->changes); record != NULL; record = zlistx_prev (self->changes)) {
+        if(record->generation <= self->state_generation)
+            break;
+        count++;
+    }
+    FILE *file = fopen(self->state_log_path, "ab");
+    if(!file) {
+        zsys_error("zsimpledisco: unable to append state to %s: %s", self->state_log_path, strerror(errno));
+        return -1;
+    }
+    state_header_t header;
+    s_state_header(&header, STATE_LOG_MAGIC, count, self->state_sequence + 1);
+    fwrite(&header, sizeof (header), 1, file);
+    size_t size = sizeof (header);
+    //  The cursor stops just before the first new record; write them in
+    //  generation order so the replay ends with the latest value of a key
+    for (record = zlistx_next (self->changes); record != NULL; record = zlistx_next (self->changes))
+        size += s_state_write_record(file, now, record);
+    int rc = ferror(file) ? -1 : 0;
+    if(fclose(file))
+        rc = -1;
+    if(rc) {
+        //  The batch may be partly written, a fresh state file is safer
+        zsys_error("zsimpledisco: unable to append state to %s: %s", self->state_log_path, strerror(errno));
+        return s_self_compact_state(self);
+    }
+    self->state_sequence++;
+    self->state_generation = self->generation;
+    self->state_log_size += size;
+    if (self->verbose)
+        zsys_debug("zsimpledisco: logged %u changed records to %s", count, self->state_log_path);
     return 0;
 }
 
+//  Restore the records of a state file or one log batch, aged by the time
+//  that passed since it was written. Returns the number of bytes used, or 0
+//  if the data is truncated.
+static size_t
+s_self_load_state_records(self_t *self, byte *data, size_t size, state_header_t *header,
+    bool apply, uint32_t *restored)
+{
+    int64_t elapsed = zclock_time() - header->saved;
+    if(elapsed < 0)
+        elapsed = 0;
+    byte *needle = data;
+    byte *ceiling = data + size;
+    char *key = NULL;
+    char *value = NULL;
+    uint32_t index;
+    for (index = 0; index < header->count; index++) {
+        state_record_t state_record;
+        if((size_t) (ceiling - needle) < sizeof (state_record))
+            break;
+        memcpy(&state_record, needle, sizeof (state_record));
+        needle += sizeof (state_record);
+        if((size_t) (ceiling - needle) < (size_t) state_record.key_size + state_record.value_size)
+            break;
+        if(apply) {
+            key = (char *) realloc(key, state_record.key_size + 1);
+            value = (char *) realloc(value, state_record.value_size + 1);
+            assert(key && value);
+            memcpy(key, needle, state_record.key_size);
+            key[state_record.key_size] = 0;
+            memcpy(value, needle + state_record.key_size, state_record.value_size);
+            value[state_record.value_size] = 0;
+
+            int64_t age = state_record.age + elapsed;
+            if(!(state_record.flags & STATE_RECORD_REMOVED) && age < s_self_ttl(self, state_record.ttl)) {
+                s_self_set_kv(self, key, value, zclock_mono() - age, state_record.ttl);
+                (*restored)++;
+            }
+            else {
+                value_t *record = (value_t *) zregistry_lookup (self->data, key);
+                if(record)
+                    s_self_expire_kv(self, record);
+            }
+        }
+        needle += state_record.key_size + state_record.value_size;
+    }
+    free(key);
+    free(value);
+    return index < header->count ? 0 : (size_t) (needle - data);
+}
+
+//  Map path, returns NULL if it is missing or unreadable
+static byte *
+s_state_map(const char *path, size_t *size_p)
+{
+    int fd = open(path, O_RDONLY);
+    if(fd == -1) {
+        if(errno != ENOENT)
+            zsys_error("zsimpledisco: unable to read state from %s: %s", path, strerror(errno));
+        return NULL;
+    }
+    struct stat st;
+    if(fstat(fd, &st) || (size_t) st.st_size < sizeof (state_header_t)) {
+        close(fd);
+        return NULL;
+    }
+    *size_p = (size_t) st.st_size;
+    byte *map = (byte *) mmap(NULL, *size_p, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        zsys_error("zsimpledisco: unable to map state file %s: %s", path, strerror(errno));
+        return NULL;
+    }
+    return map;
+}
+
+//  Restore every record of the state file that would not have expired
+//  yet, then replay the log batches written after it.
 static int
+s_self_load_state(self_t *self)
+{
+    size_t size;
+    byte *map = s_state_map(self->state_path, &size);
+    uint32_t restored = 0;
+    if(map) {
+        state_header_t header;
+        memcpy(&header, map, sizeof (header));
+        if(memcmp(header.magic, STATE_FILE_MAGIC, sizeof (header.magic))) {
+            zsys_error("zsimpledisco: %s is not a state file", self->state_path);
+            munmap(map, size);
+            return -1;
+        }
+        if(!s_self_load_state_records(self, map + sizeof (header), size - sizeof (header), &header, true, &restored))
+            zsys_error("zsimpledisco: state file %s is truncated", self->state_path);
+        self->state_sequence = header.sequence;
+        munmap(map, size);
+        zsys_info("zsimpledisco: restored %u of %u records from %s", restored, header.count, self->state_path);
+    }
+
+    map = s_state_map(self->state_log_path, &size);
+    if(map) {
+        uint32_t batches = 0;
+        restored = 0;
+        size_t offset = 0;
+        while (size - offset >= sizeof (state_header_t)) {
+            state_header_t header;
+            memcpy(&header, map + offset, sizeof (header));
+            if(memcmp(header.magic, STATE_LOG_MAGIC, sizeof (header.magic)))
+                break;
+            offset += sizeof (header);
+            //  Batches the state file already includes are skipped
+            bool apply = header.sequence > self->state_sequence;
+            size_t used = s_self_load_state_records(self, map + offset, size - offset, &header, apply, &restored);
+            if(!used && header.count)
+                break;
+            offset += used;
+            if(apply) {
+                self->state_sequence = header.sequence;
+                batches++;
+            }
+        }
+        if(offset < size)
+            zsys_error("zsimpledisco: ignoring the truncated end of state log %s", self->state_log_path);
+        munmap(map, size);
+        zsys_info("zsimpledisco: replayed %u batches, %u records from %s", batches, restored, self->state_log_path);
+    }
+    //  Start from a fresh state file and an empty log
+    return s_self_compact_state(self);
+}
+
+int
+s_self_set_state_path(self_t *self, const char *path)
+{
+    if(self->verbose)
+        zsys_info("zsimpledisco: State file: %s", path);
+    zstr_free(&self->state_path);
+    zstr_free(&self->state_log_path);
+    self->state_path = strdup(path);
+    self->state_log_path = zsys_sprintf("%s.log", path);
+    s_self_timer_at(self, self->state_timer, zclock_mono() + self->state_save_interval);
+    return s_self_load_state(self);
+}
+
+static void
 s_self_handle_cleanup(self_t *self)
 {
     //zsimpledisco_dump_hash(self->data);
     s_self_handle_expire_data(self);
+    s_self_expire_watchers(self);
+    s_self_timer_at(self, self->cleanup_timer, zclock_mono() + self->cleanup_interval);
+}
 
-    return 0;
+static void
+s_self_handle_state_save(self_t *self)
+{
+    s_self_save_state(self);
+    s_self_timer_at(self, self->state_timer, zclock_mono() + self->state_save_interval);
+}
+
+static void
+s_self_handle_sync_timer(self_t *self)
+{
+    s_self_sync_replicas(self);
+    s_self_timer_at(self, self->sync_timer, zclock_mono() + self->sync_interval);
 }
 
 // Common stuff
 
+//  Keys with a TTL are refreshed well before the shortest one runs out
+static void
+s_self_update_min_ttl(self_t *self)
+{
+    self->client_min_ttl = 0;
+    char *ttl;
+    for (ttl = zregistry_first (self->client_ttls); ttl != NULL; ttl = zregistry_next (self->client_ttls))
+        if(!self->client_min_ttl || atoi(ttl) < self->client_min_ttl)
+            self->client_min_ttl = atoi(ttl);
+}
+
+static int
+s_self_send_interval(self_t *self)
+{
+    if(self->client_min_ttl && self->client_min_ttl / 2 < self->send_interval)
+        return self->client_min_ttl / 2;
+    return self->send_interval;
+}
+
+static int
+s_self_set_interval(self_t *self, const char *name, int msecs)
+{
+    if(msecs <= 0)
+        return -1;
+    if(streq(name, "deliver")) {
+        self->deliver_interval = msecs;
+        s_self_timer_at(self, self->deliver_timer, zclock_mono() + msecs);
+    }
+    else
+    if(streq(name, "send")) {
+        self->send_interval = msecs;
+        s_self_timer_at(self, self->send_timer, zclock_mono() + s_self_send_interval(self));
+    }
+    else
+    if(streq(name, "cleanup")) {
+        self->cleanup_interval = msecs;
+        s_self_timer_at(self, self->cleanup_timer, zclock_mono() + msecs);
+    }
+    else
+    if(streq(name, "max age"))
+        self->cleanup_max_age = msecs;
+    else
+    if(streq(name, "state save")) {
+        self->state_save_interval = msecs;
+        if(self->state_path)
+            s_self_timer_at(self, self->state_timer, zclock_mono() + msecs);
+    }
+    else
+    if(streq(name, "reconnect"))
+        self->reconnect_interval = msecs;
+    else
+    if(streq(name, "peer timeout")) {
+        self->peer_timeout = msecs;
+        peer_t *peer;
+        for (peer = zregistry_first (self->client_peers); peer != NULL; peer = zregistry_next (self->client_peers)) {
+            if(!peer->sock)
+                continue;
+            zsock_set_sndtimeo(peer->sock, msecs);
+            zsock_set_rcvtimeo(peer->sock, msecs);
+        }
+    }
+    else
+        return -1;
+    return 0;
+}
+
 static int
 s_self_handle_pipe (self_t *self)
 {
@@ -576,6 +2457,12 @@ s_self_handle_pipe (self_t *self)
         zstr_free(&path);
     }
     else
+    if (streq (command, "SET STATE PATH")) {
+        char *path = zstr_recv (self->pipe);
+        s_self_set_state_path(self, path);
+        zstr_free(&path);
+    }
+    else
     if (streq (command, "SET PRIVATE KEY PATH")) {
         char *path = zstr_recv (self->pipe);
         if(s_self_set_private_key_path(self, path))
@@ -599,15 +2486,65 @@ s_self_handle_pipe (self_t *self)
         zstr_free(&endpoint);
     }
     else
+    if (streq (command, "DISCONNECT")) {
+        char *endpoint = zstr_recv (self->pipe);
+        s_self_disconnect(self, endpoint);
+        zstr_free(&endpoint);
+    }
+    else
+    if (streq (command, "REPLICATE")) {
+        char *endpoint = zstr_recv (self->pipe);
+        if(s_self_replicate(self, endpoint))
+            zsys_error ("could not replicate with %s", endpoint);
+        zstr_free(&endpoint);
+    }
+    else
     if (streq (command, "PUBLISH")) {
         char *key = zstr_recv(self->pipe);
         char *value = zstr_recv(self->pipe);
-        zhash_update (self->client_data, key, value);
+        char *ttl = zsock_rcvmore(self->pipe) ? zstr_recv(self->pipe) : NULL;
+        zregistry_update (self->client_data, key, value);
+        if(ttl && atoi(ttl) > 0)
+            zregistry_update (self->client_ttls, key, ttl);
+        else
+            zregistry_delete (self->client_ttls, key);
+        s_self_update_min_ttl(self);
+        //  Our leases don't cover the new value, the next send registers it
+        self->client_data_version++;
         s_self_client_publish(self, key, value);
+        zstr_free(&key);
+        zstr_free(&value);
+        zstr_free(&ttl);
+    }
+    else
+    if (streq (command, "WATCH")) {
+        zstr_free(&self->watch_prefix);
+        self->watch_prefix = zstr_recv(self->pipe);
+        //  Register with the servers right away
+        s_self_timer_at(self, self->deliver_timer, zclock_mono());
     }
     else
     if (streq (command, "GET VALUES")) {
-        self->last_deliver = 0;
+        //  Forget what was delivered so everything is delivered again
+        zregistry_destroy(&self->delivered);
+        self->delivered = zregistry_new();
+        zregistry_autofree(self->delivered);
+        s_self_timer_at(self, self->deliver_timer, zclock_mono());
+    }
+    else
+    if (streq (command, "SET INTERVAL")) {
+        char *name = zstr_recv (self->pipe);
+        char *msecs = zstr_recv (self->pipe);
+        if(s_self_set_interval(self, name, atoi(msecs)))
+            zsys_error ("zsimpledisco: invalid interval %s=%s", name, msecs);
+        zstr_free(&name);
+        zstr_free(&msecs);
+    }
+    else
+    if (streq (command, "STATS")) {
+        char *stats = s_self_stats(self);
+        zstr_send (self->pipe, stats);
+        zstr_free (&stats);
     }
     else
     if (streq (command, "$TERM"))
@@ -620,19 +2557,36 @@ s_self_handle_pipe (self_t *self)
     return 0;
 }
 
+//  Refresh the merged view from the servers and deliver what changed
 void
 s_self_deliver_all (self_t *self)
 {
-    zhash_t *h = zhash_new();
-    zhash_autofree(h);
+    //  Borrows the values from the peers, nothing may reconnect while it lives
+    zregistry_t *h = zregistry_new();
     s_self_client_get_values(self, h);
     char *val;
-    for (val = zhash_first (h); val != NULL; val = zhash_next (h)) {
-        const char *key = zhash_cursor (h);
+    for (val = zregistry_first (h); val != NULL; val = zregistry_next (h)) {
+        const char *key = zregistry_cursor (h);
         //zsys_debug("zsimpledisco: key='%s' value='%s', key, val);
-        zstr_sendx(self->outbox, key, val, NULL);
+        s_self_deliver_value(self, key, val);
+    }
+
+    for (val = zregistry_first (self->delivered); val != NULL; val = zregistry_next (self->delivered)) {
+        const char *key = zregistry_cursor (self->delivered);
+        if(!zregistry_lookup (h, key))
+            s_self_deliver_value(self, key, NULL);
     }
-    zhash_destroy(&h);
+    zregistry_destroy(&h);
+    s_self_timer_at(self, self->deliver_timer, zclock_mono() + self->deliver_interval);
+}
+
+static void
+s_self_handle_send(self_t *self)
+{
+    s_self_client_publish_all(self);
+    //  Unless a reply already asked for an earlier send
+    if(!self->send_timer->slot)
+        s_self_timer_at(self, self->send_timer, zclock_mono() + s_self_send_interval(self));
 }
 
 void
@@ -649,38 +2603,147 @@ zsimpledisco_actor (zsock_t *pipe, void *args)
     zpoller_t *poller = zpoller_new (NULL);
     zpoller_add (poller, self->pipe);
     zpoller_add (poller, self->server_socket);
-
+    self->poller = poller;
+
+    //  Delivering, sending and cleaning up all start right away
+    self->timers = zexpiry_new();
+    self->deliver_timer = s_deadline_new(s_self_deliver_all);
+    self->send_timer = s_deadline_new(s_self_handle_send);
+    self->cleanup_timer = s_deadline_new(s_self_handle_cleanup);
+    self->state_timer = s_deadline_new(s_self_handle_state_save);
+    self->sync_timer = s_deadline_new(s_self_handle_sync_timer);
+    self->allowlist_timer = s_deadline_new(s_self_check_allowlist);
+    s_self_timer_at(self, self->deliver_timer, 0);
+    s_self_timer_at(self, self->send_timer, 0);
+    s_self_timer_at(self, self->cleanup_timer, 0);
+
+    //  Sleep until the next timer is due, but wake up now and then to
+    //  hold off the watchdog
+    int64_t last_watchdog = 0;
     while (!self->terminated) {
-        alarm(120);
-        zsock_t *which = (zsock_t *) zpoller_wait (poller, 1000);
+        int64_t now = zclock_mono();
+        if(now - last_watchdog >= 30 * 1000) {
+            alarm(120);
+            last_watchdog = now;
+        }
+        int64_t timeout = 60 * 1000;
+        int64_t next_deadline = zexpiry_next_deadline(self->timers);
+        if(next_deadline >= 0 && next_deadline - now < timeout)
+            timeout = next_deadline > now ? next_deadline - now : 0;
+
+        zsock_t *which = (zsock_t *) zpoller_wait (poller, (int) timeout);
+        int64_t woke = zclock_usecs();
         if(which == self->pipe) {
             s_self_handle_pipe (self);
         }
+        else
         if(which == self->server_socket) {
             s_self_handle_server_socket(self);
         }
-
-        if(zpoller_expired(poller)) {
-            //zsys_debug ("zsimpledisco: Idle");
-        }
-        if(zclock_mono() - self->last_deliver > self->deliver_interval) {
-            s_self_deliver_all(self);
-            self->last_deliver = zclock_mono();
+        else
+        if(which) {
+            s_self_handle_peer_socket(self, which);
         }
 
-        if(zclock_mono() - self->last_cleanup > self->cleanup_interval) {
-            s_self_handle_cleanup(self);
-            self->last_cleanup = zclock_mono();
-        }
-        if(zclock_mono() - self->last_send > self->send_interval) {
-            s_self_client_publish_all(self);
-            self->last_send = zclock_mono();
-        }
-        if(zclock_mono() - self->last_reconnect > self->reconnect_interval) {
-            s_self_client_reconnect_all(self);
-            self->last_reconnect = zclock_mono();
-        }
+        s_self_run_timers(self);
+        s_histogram_add(&self->stats.loop_lag, zclock_usecs() - woke);
     }
     alarm(0);
     s_self_destroy(&self);
 }
+
+//  --------------------------------------------------------------------------
+//  Self test
+
+//  Poll the server at endpoint with VALUES until it has key, returns the
+//  msecs that took or -1 after timeout msecs
+static int64_t
+s_test_wait_for_key(const char *endpoint, const char *key, int timeout)
+{
+    zsock_t *client = zsock_new (ZMQ_DEALER);
+    zsock_set_rcvtimeo (client, 200);
+    zsock_connect (client, "%s", endpoint);
+    int64_t start = zclock_mono ();
+    int64_t waited = -1;
+    while (zclock_mono () - start < timeout) {
+        zstr_send (client, "VALUES");
+        zmsg_t *reply = zmsg_recv (client);
+        zregistry_t *values = reply && zmsg_last (reply) ? zregistry_unpack (zmsg_last (reply)) : NULL;
+        bool found = values && zregistry_lookup (values, key);
+        zregistry_destroy (&values);
+        zmsg_destroy (&reply);
+        if (found) {
+            waited = zclock_mono () - start;
+            break;
+        }
+        zclock_sleep (20);
+    }
+    zsock_destroy (&client);
+    return waited;
+}
+
+void
+zsimpledisco_test(bool verbose)
+{
+    printf (" * zsimpledisco: ");
+    char *endpoint = zsys_sprintf ("ipc:///tmp/zsimpledisco-test-%d", getpid ());
+    const char *key = "tcp://10.0.0.1:5670";
+    int send_interval = 1000;
+
+    zsimpledisco_t *server = zsimpledisco_new ();
+    zsimpledisco_bind (server, endpoint);
+    zsimpledisco_t *client = zsimpledisco_new ();
+    if (verbose)
+        zsimpledisco_verbose (client);
+    zsimpledisco_set_send_interval (client, send_interval);
+    zsimpledisco_set_peer_timeout (client, 200);
+    zsimpledisco_connect (client, endpoint);
+    zsimpledisco_publish (client, key, "test-uuid");
+    assert (s_test_wait_for_key (endpoint, key, 3000) >= 0);
+
+    //  A restarted server has forgotten the lease, so the next RENEW gets
+    //  UNKNOWN. The keys must be registered again by that same send, not a
+    //  send interval later.
+    zclock_sleep (send_interval + 100);
+    zsimpledisco_destroy (&server);
+    server = zsimpledisco_new ();
+    zsimpledisco_bind (server, endpoint);
+    int64_t waited = s_test_wait_for_key (endpoint, key, 3 * send_interval);
+    if (verbose)
+        zsys_debug ("zsimpledisco: restarted server had the key back after %" PRId64 " ms", waited);
+    assert (waited >= 0 && waited < send_interval + 500);
+    zsimpledisco_destroy (&client);
+    zsimpledisco_destroy (&server);
+
+    //  A key that is only renewed never changes the table, yet the state
+    //  saved after a quiet period must still restore it
+    char *state_path = zsys_sprintf ("/tmp/zsimpledisco-test-%d.state", getpid ());
+    char *state_log_path = zsys_sprintf ("%s.log", state_path);
+    int max_age = 3000;
+    server = zsimpledisco_new ();
+    zsimpledisco_set_max_age (server, max_age);
+    zsimpledisco_set_state_save_interval (server, 200);
+    zsimpledisco_set_state_path (server, state_path);
+    zsimpledisco_bind (server, endpoint);
+    client = zsimpledisco_new ();
+    zsimpledisco_set_send_interval (client, 500);
+    zsimpledisco_connect (client, endpoint);
+    zsimpledisco_publish (client, key, "test-uuid");
+    assert (s_test_wait_for_key (endpoint, key, 3000) >= 0);
+    zclock_sleep (3 * max_age);
+    zsimpledisco_destroy (&client);
+    zsimpledisco_destroy (&server);
+    server = zsimpledisco_new ();
+    zsimpledisco_set_max_age (server, max_age);
+    zsimpledisco_set_state_path (server, state_path);
+    zsimpledisco_bind (server, endpoint);
+    assert (s_test_wait_for_key (endpoint, key, 500) >= 0);
+    zsimpledisco_destroy (&server);
+    unlink (state_path);
+    unlink (state_log_path);
+    zstr_free (&state_path);
+    zstr_free (&state_log_path);
+
+    zstr_free (&endpoint);
+    printf ("OK\n");
+}
@@ -1,6 +1,8 @@
 #ifndef __ZSIMPLEDISCO_H_INCLUDED__
 #define __ZSIMPLEDISCO_H_INCLUDED__
 
+#include "zregistry.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -10,6 +12,9 @@ typedef struct _zsimpledisco_t zsimpledisco_t;
 CZMQ_EXPORT zsimpledisco_t *
     zsimpledisco_new();
 
+//  Socket the discovered key/values are delivered on. Each message is
+//  ADDED|CHANGED key value, or REMOVED key last_value, and is only sent
+//  when the merged view from the servers differs from what was delivered.
 CZMQ_EXPORT zsock_t *
     zsimpledisco_socket (zsimpledisco_t *self);
 
@@ -22,6 +27,11 @@ CZMQ_EXPORT void
 CZMQ_EXPORT void
     zsimpledisco_connect(zsimpledisco_t *self, const char *endpoint);
 
+//  Stop using a server given to zsimpledisco_connect. Keys only it knew
+//  about are reported REMOVED on the next delivery.
+CZMQ_EXPORT void
+    zsimpledisco_disconnect(zsimpledisco_t *self, const char *endpoint);
+
 CZMQ_EXPORT void
     zsimpledisco_bind(zsimpledisco_t *self, const char *endpoint);
 
@@ -31,16 +41,69 @@ CZMQ_EXPORT void
 CZMQ_EXPORT void
     zsimpledisco_publish(zsimpledisco_t *self, const char *key, const char* value);
 
+//  Publish a key the servers expire ttl msecs after its last refresh,
+//  instead of after their max age. Keys are refreshed at least twice per TTL.
+CZMQ_EXPORT void
+    zsimpledisco_publish_ttl(zsimpledisco_t *self, const char *key, const char* value, int ttl);
+
+//  Timing, all in msecs. Deliver: how often the merged view is fetched from
+//  the servers. Send: how often our keys are refreshed on the servers.
+//  Cleanup: how often the server expires keys. Max age: how long the server
+//  keeps keys without a TTL. Reconnect: longest backoff before probing an
+//  unreachable server again. Peer timeout: how long to wait for a reply.
+//  State save: how often the server records are saved to the state path.
+CZMQ_EXPORT void
+    zsimpledisco_set_deliver_interval(zsimpledisco_t *self, int msecs);
+CZMQ_EXPORT void
+    zsimpledisco_set_send_interval(zsimpledisco_t *self, int msecs);
+CZMQ_EXPORT void
+    zsimpledisco_set_cleanup_interval(zsimpledisco_t *self, int msecs);
+CZMQ_EXPORT void
+    zsimpledisco_set_max_age(zsimpledisco_t *self, int msecs);
+CZMQ_EXPORT void
+    zsimpledisco_set_state_save_interval(zsimpledisco_t *self, int msecs);
+CZMQ_EXPORT void
+    zsimpledisco_set_reconnect_interval(zsimpledisco_t *self, int msecs);
+CZMQ_EXPORT void
+    zsimpledisco_set_peer_timeout(zsimpledisco_t *self, int msecs);
+
+//  Deliver every known key/value again as ADDED, as soon as possible
 CZMQ_EXPORT void
     zsimpledisco_get_values(zsimpledisco_t *self);
 
+//  Have the servers push changes to keys starting with prefix as they happen,
+//  instead of waiting for the next periodic delivery. NULL or "" watches all.
+CZMQ_EXPORT void
+    zsimpledisco_watch(zsimpledisco_t *self, const char *prefix);
+
 CZMQ_EXPORT int
-    zsimpledisco_dump_hash(zhash_t *h);
+    zsimpledisco_dump_hash(zregistry_t *h);
+
+//  Counters and latency histograms of this instance, server and client
+//  side, in the Prometheus text format. Caller frees the string.
+CZMQ_EXPORT char *
+    zsimpledisco_stats(zsimpledisco_t *self);
+
+//  Handle one message on a ZMQ_STREAM socket: an HTTP request is answered
+//  with the stats followed by extra, which may be NULL, then closed.
+CZMQ_EXPORT void
+    zsimpledisco_serve_stats(zsimpledisco_t *self, zsock_t *stream, const char *extra);
 
 CZMQ_EXPORT int
         zsimpledisco_set_certstore_path(zsimpledisco_t *self, const char *certstore_path);
 CZMQ_EXPORT int
         zsimpledisco_set_private_key_path(zsimpledisco_t *self, const char *private_key_path);
+//  Restore the server records from state_path, and save them there periodically
+CZMQ_EXPORT int
+        zsimpledisco_set_state_path(zsimpledisco_t *self, const char *state_path);
+//  Keep this server's records in step with the server at endpoint, which may
+//  end in |public_key. Both servers should replicate with each other.
+CZMQ_EXPORT void
+        zsimpledisco_replicate(zsimpledisco_t *self, const char *endpoint);
+
+//  Self test of this class
+CZMQ_EXPORT void
+        zsimpledisco_test(bool verbose);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,136 @@
+#include "czmq_library.h"
+#include "zslab.h"
+
+#define ITEMS_PER_CHUNK 256
+
+typedef struct _free_item_t {
+    struct _free_item_t *next;
+} free_item_t;
+
+struct _zslab_t {
+    size_t item_size;
+    free_item_t *free_list;     //  Freed items, reused first
+    char **chunks;              //  Every chunk allocated, released on destroy
+    size_t nbr_chunks;
+    size_t used;
+};
+
+zslab_t *
+zslab_new (size_t item_size)
+{
+    zslab_t *self = (zslab_t *) zmalloc (sizeof (zslab_t));
+    assert (self);
+    //  Keep every item aligned for any type and big enough to link
+    size_t align = sizeof (void *) > sizeof (int64_t)? sizeof (void *): sizeof (int64_t);
+    if (item_size < sizeof (free_item_t))
+        item_size = sizeof (free_item_t);
+    self->item_size = (item_size + align - 1) / align * align;
+    return self;
+}
+
+void
+zslab_destroy (zslab_t **self_p)
+{
+    assert (self_p);
+    if (*self_p) {
+        zslab_t *self = *self_p;
+        size_t index;
+        for (index = 0; index < self->nbr_chunks; index++)
+            free (self->chunks [index]);
+        free (self->chunks);
+        freen (self);
+        *self_p = NULL;
+    }
+}
+
+static void
+s_add_chunk (zslab_t *self)
+{
+    char *chunk = (char *) malloc (self->item_size * ITEMS_PER_CHUNK);
+    assert (chunk);
+    self->chunks = (char **) realloc (self->chunks, (self->nbr_chunks + 1) * sizeof (char *));
+    assert (self->chunks);
+    self->chunks [self->nbr_chunks++] = chunk;
+
+    //  Thread the new items onto the free list, first item on top
+    int index;
+    for (index = ITEMS_PER_CHUNK - 1; index >= 0; index--) {
+        free_item_t *item = (free_item_t *) (chunk + index * self->item_size);
+        item->next = self->free_list;
+        self->free_list = item;
+    }
+}
+
+void *
+zslab_alloc (zslab_t *self)
+{
+    assert (self);
+    if (!self->free_list)
+        s_add_chunk (self);
+    free_item_t *item = self->free_list;
+    self->free_list = item->next;
+    memset (item, 0, self->item_size);
+    self->used++;
+    return item;
+}
+
+void
+zslab_free (zslab_t *self, void *item)
+{
+    assert (self);
+    if (!item)
+        return;
+    free_item_t *free_item = (free_item_t *) item;
+    free_item->next = self->free_list;
+    self->free_list = free_item;
+    self->used--;
+}
+
+size_t
+zslab_used (zslab_t *self)
+{
+    assert (self);
+    return self->used;
+}
+
+void
+zslab_test (bool verbose)
+{
+    printf (" * zslab: ");
+    zslab_t *self = zslab_new (24);
+
+    //  A freed item is the next one handed out, zeroed
+    char *item = (char *) zslab_alloc (self);
+    memset (item, 'x', 24);
+    zslab_free (self, item);
+    char *again = (char *) zslab_alloc (self);
+    assert (again == item);
+    int index;
+    for (index = 0; index < 24; index++)
+        assert (again [index] == 0);
+    zslab_free (self, again);
+    assert (zslab_used (self) == 0);
+
+    //  More items than one chunk, then the same number again without a new chunk
+    int nbr_items = ITEMS_PER_CHUNK + ITEMS_PER_CHUNK / 2;
+    void **items = (void **) zmalloc (nbr_items * sizeof (void *));
+    for (index = 0; index < nbr_items; index++)
+        items [index] = zslab_alloc (self);
+    assert (zslab_used (self) == (size_t) nbr_items);
+    size_t nbr_chunks = self->nbr_chunks;
+    assert (nbr_chunks == 2);
+    for (index = 0; index < nbr_items; index++)
+        zslab_free (self, items [index]);
+    for (index = 0; index < nbr_items; index++)
+        items [index] = zslab_alloc (self);
+    assert (self->nbr_chunks == nbr_chunks);
+    for (index = 0; index < nbr_items; index++)
+        zslab_free (self, items [index]);
+    assert (zslab_used (self) == 0);
+    free (items);
+
+    if (verbose)
+        zsys_debug ("zslab: %zu byte items in %zu chunks", self->item_size, self->nbr_chunks);
+    zslab_destroy (&self);
+    printf ("OK\n");
+}
@@ -0,0 +1,38 @@
+#ifndef __ZSLAB_H_INCLUDED__
+#define __ZSLAB_H_INCLUDED__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//  Pool of fixed size items carved out of large chunks. Freed items are kept
+//  on a free list for reuse and all memory is released with the slab, so a
+//  steady state of allocs and frees never reaches the heap.
+typedef struct _zslab_t zslab_t;
+
+CZMQ_EXPORT zslab_t *
+    zslab_new (size_t item_size);
+
+CZMQ_EXPORT void
+    zslab_destroy (zslab_t **self_p);
+
+//  Returns a zeroed item
+CZMQ_EXPORT void *
+    zslab_alloc (zslab_t *self);
+
+CZMQ_EXPORT void
+    zslab_free (zslab_t *self, void *item);
+
+//  Number of items handed out and not yet freed
+CZMQ_EXPORT size_t
+    zslab_used (zslab_t *self);
+
+//  Self test of this class
+CZMQ_EXPORT void
+    zslab_test (bool verbose);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif